@@ -39,6 +39,7 @@
   "syn-mix-short.rep", \
   "ngram-fox1.rep", \
   "syn-mix-realloc.rep", \
+  "syn-batch-short.rep", \
   "bdd-aa4.rep", \
   "bdd-aa32.rep", \
   "bdd-ma4.rep", \
@@ -46,8 +46,8 @@
 #define REF_ONLY 0
 #endif
 
-/* Returns true if p is ALIGNMENT-byte aligned */
-#define IS_ALIGNED(p) ((((unsigned long)(p)) % ALIGNMENT) == 0)
+/* Returns true if p is a-byte aligned */
+#define IS_ALIGNED(p, a) ((((unsigned long)(p)) % (a)) == 0)
 
 /* weights */
 typedef enum { WNONE, WALL, WUTIL, WPERF } weight_t;
@@ -86,9 +86,11 @@ typedef struct {
 
 /* Characterizes a single trace operation (allocator request) */
 typedef struct {
-    enum { ALLOC, FREE, REALLOC } type; /* type of request */
-    unsigned int index;                 /* index for free() to use later */
-    size_t size;                        /* byte size of alloc/realloc request */
+    enum { ALLOC, FREE, REALLOC, BATCH_ALLOC, BATCH_FREE, ALIGNED_ALLOC } type;
+    unsigned int index; /* index for free() to use later */
+    unsigned int count; /* number of consecutive ids a batch request covers */
+    size_t size;        /* byte size of alloc/realloc request */
+    size_t align;       /* payload alignment the request asks for */
 } traceop_t;
 
 /* Holds the information for one trace file */
@@ -102,6 +104,7 @@ typedef struct {
     char **blocks;        /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes;  /* ... and a corresponding array of payload sizes */
     size_t *block_rand_base; /* index into random_data, if debug is on */
+    void **batch;         /* scratch array for the largest batch request */
 } trace_t;
 
 /*
@@ -128,6 +131,7 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util; /* space utilization for this trace (always 0 for libc) */
+    size_t sbrks; /* number of times the heap grew during one run */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t;
@@ -166,6 +170,7 @@ int verbose = REF_ONLY ? 0 : 1; /* global flag for verbose output */
 static int errors = 0; /* number of errs found when running student malloc */
 static bool onetime_flag = false;
 static bool tab_mode = false; /* Print output as tab-separated fields */
+static bool show_stats = false; /* Print the mm package's counters */
 /* If set, use sparse memory emulation */
 static bool sparse_mode = SPARSE_MODE;
 static size_t maxfill = SPARSE_MODE ? MAXFILL_SPARSE : MAXFILL;
@@ -177,6 +182,15 @@ size_t queryGlobalSpaceUsage(void);
 /* by default, no timeouts */
 static int set_timeout = 0;
 
+/* If set, requests of at least this many bytes get their own mapping */
+static size_t map_threshold = 0;
+
+/* How the mm package's heap grows, or NULL for its default */
+static const char *growth_policy = NULL;
+
+/* If set, free blocks of at least this many bytes are kept in address order */
+static size_t ordered_threshold = 0;
+
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
 
@@ -212,7 +226,7 @@ static void add_tracefile(const char *trace);
 /* these functions manipulate range sets */
 static range_set_t *new_range_set(void);
 static bool add_range(range_set_t *ranges, char *lo, size_t size,
-                      const trace_t *trace, unsigned int opnum,
+                      size_t align, const trace_t *trace, unsigned int opnum,
                       unsigned int index);
 static void remove_range(range_set_t *ranges, char *lo);
 static void free_range_set(range_set_t *ranges);
@@ -240,7 +254,10 @@ static double eval_mm_util(trace_t *trace, size_t tracenum);
 static void eval_mm_speed(void *ptr);
 
 /* Various helper routines */
-static void printresults(size_t n, stats_t *stats, sum_stats_t *sumstats);
+static void print_bin_stats(void);
+static void print_mm_stats(const char *filename);
+static void printresults(size_t n, stats_t *stats, sum_stats_t *sumstats,
+                         bool show_sbrks);
 static void usage(char *prog);
 static void malloc_error(const trace_t *trace, unsigned int opnum,
                          const char *fmt, ...)
@@ -285,7 +302,6 @@ static void run_tests(size_t num_tracefiles, const char *tracedir,
         trace_t *trace;
         trace = read_trace(&mm_stats[i], tracedir, tracefiles[i]);
         strcpy(mm_stats[i].filename, trace->filename);
-        mm_stats[i].ops = trace->num_ops;
 
         /* Prepare for timeout */
         if (setjmp(timeout_jmpbuf) != 0) {
@@ -301,6 +317,11 @@ static void run_tests(size_t num_tracefiles, const char *tracedir,
             ranges = new_range_set();
             mm_stats[i].valid =
                 mm_stats[i].valid && eval_mm_valid(trace, ranges);
+            mm_stats[i].sbrks = mem_sbrk_calls();
+            if (verbose > 1)
+                print_bin_stats();
+            if (show_stats)
+                print_mm_stats(trace->filename);
 
             if (onetime_flag) {
                 if (verbose > 1)
@@ -369,7 +390,7 @@ int main(int argc, char **argv) {
     /*
      * Read and interpret the command line arguments
      */
-    while ((c = getopt(argc, argv, "d:f:c:s:t:v:hpCOVAlDT")) != EOF) {
+    while ((c = getopt(argc, argv, "d:f:c:s:t:v:M:G:o:hpCOVAlDST")) != EOF) {
         switch (c) {
 
         case 'A': /* Hidden Autolab driver argument */
@@ -428,6 +449,22 @@ int main(int argc, char **argv) {
             tab_mode = true;
             break;
 
+        case 'S': /* Print the mm package's counters after each trace */
+            show_stats = true;
+            break;
+
+        case 'M': /* Set the mm package's mapping threshold */
+            map_threshold = (size_t)strtoull(optarg, NULL, 0);
+            break;
+
+        case 'G': /* Set the mm package's heap growth policy */
+            growth_policy = optarg;
+            break;
+
+        case 'o': /* Set the mm package's address-ordered threshold */
+            ordered_threshold = (size_t)strtoull(optarg, NULL, 0);
+            break;
+
         case 'h': /* Print this message */
             usage(argv[0]);
             exit(0);
@@ -439,6 +476,19 @@ int main(int argc, char **argv) {
     }
 #endif /* !REF_ONLY */
 
+    if (map_threshold != 0)
+        mm_set_map_threshold(map_threshold);
+    if (growth_policy != NULL) {
+        if (strcmp(growth_policy, "fixed") == 0)
+            mm_set_growth(MM_GROW_FIXED);
+        else if (strcmp(growth_policy, "adaptive") == 0)
+            mm_set_growth(MM_GROW_ADAPTIVE);
+        else
+            app_error("Unknown growth policy %s", growth_policy);
+    }
+    if (ordered_threshold != 0)
+        mm_set_ordered_threshold(ordered_threshold);
+
     if (num_global_tracefiles == 0) {
         int i;
         if (sparse_mode & !run_libc) {
@@ -493,7 +543,7 @@ int main(int argc, char **argv) {
         if (verbose) {
             printf("\nResults for libc malloc:\n");
             printresults(num_global_tracefiles, libc_stats,
-                         &global_libc_sum_stats);
+                         &global_libc_sum_stats, false);
         }
     }
 
@@ -543,7 +593,8 @@ int main(int argc, char **argv) {
             }
         } else {
             printf("\nResults for mm malloc:\n");
-            printresults(num_global_tracefiles, mm_stats, &global_mm_sum_stats);
+            printresults(num_global_tracefiles, mm_stats, &global_mm_sum_stats,
+                         true);
             printf("\n");
         }
     }
@@ -726,27 +777,41 @@ static range_set_t *new_range_set(void) {
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of
- *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list.
+ *     size bytes at addr lo, aligned to at least align bytes. After checking
+ *     the block for correctness, we create a range struct for this block
+ *     and add it to the range list.
  */
 static bool add_range(range_set_t *ranges, char *lo, size_t size,
-                      const trace_t *trace, unsigned int opnum,
+                      size_t align, const trace_t *trace, unsigned int opnum,
                       unsigned int index) {
     char *hi = lo + size - 1;
 
     assert(size > 0);
 
-    /* Payload addresses must be ALIGNMENT-byte aligned */
-    if (!IS_ALIGNED(lo)) {
+    /* Payload addresses must be ALIGNMENT-byte aligned, or more if the
+       request asked for it */
+    if (align < ALIGNMENT)
+        align = ALIGNMENT;
+    if (!IS_ALIGNED(lo, align)) {
         malloc_error(trace, opnum,
-                     "Payload address (%p) not aligned to %d bytes", (void *)lo,
-                     ALIGNMENT);
+                     "Payload address (%p) not aligned to %zu bytes",
+                     (void *)lo, align);
         return false;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
-        (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The package must own up to every byte asked for */
+    if (mm_usable_size(lo) < size) {
+        malloc_error(trace, opnum,
+                     "Payload (%p) has only %zu usable bytes, not %zu",
+                     (void *)lo, mm_usable_size(lo), size);
+        return false;
+    }
+
+    /* The payload must lie within the extent of the heap or of the
+       mapped regions */
+    bool in_heap = lo >= (char *)mem_heap_lo() && hi <= (char *)mem_heap_hi();
+    bool in_maps = lo >= (char *)mem_map_lo() && hi <= (char *)mem_map_hi();
+    if (!in_heap && !in_maps) {
         malloc_error(trace, opnum, "Payload (%p:%p) lies outside heap (%p:%p)",
                      (void *)lo, (void *)hi, (void *)mem_heap_lo(),
                      (void *)mem_heap_hi());
@@ -941,9 +1006,13 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     trace_t *trace;
     char type[MAXLINE];
     unsigned int index;
+    unsigned int count;
     size_t size;
+    size_t align;
     unsigned int max_index = 0;
+    unsigned int max_count = 1;
     unsigned int op_index;
+    size_t requests = 0;
     int ignore = 0;
 
     if (verbose > 1)
@@ -994,6 +1063,8 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     index = 0;
     op_index = 0;
     while (fscanf(tracefile, "%s", type) != EOF) {
+        count = 1;
+        trace->ops[op_index].align = ALIGNMENT;
         switch (type[0]) {
         case 'a':
             ignore += fscanf(tracefile, "%u %lu", &index, &size);
@@ -1009,15 +1080,46 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
             trace->ops[op_index].size = size;
             max_index = (index > max_index) ? index : max_index;
             break;
+        case 'm':
+            ignore += fscanf(tracefile, "%u %lu %lu", &index, &align, &size);
+            if (align == 0 || (align & (align - 1)) != 0)
+                app_error("Bad alignment %lu in tracefile %s\n", align,
+                          trace->filename);
+            trace->ops[op_index].type = ALIGNED_ALLOC;
+            trace->ops[op_index].index = index;
+            trace->ops[op_index].size = size;
+            trace->ops[op_index].align = align;
+            max_index = (index > max_index) ? index : max_index;
+            break;
         case 'f':
             ignore += fscanf(tracefile, "%u", &index);
             trace->ops[op_index].type = FREE;
             trace->ops[op_index].index = index;
             break;
+        case 'A':
+            ignore += fscanf(tracefile, "%u %u %lu", &index, &count, &size);
+            if (count == 0)
+                app_error("Empty batch in tracefile %s\n", trace->filename);
+            trace->ops[op_index].type = BATCH_ALLOC;
+            trace->ops[op_index].index = index;
+            trace->ops[op_index].size = size;
+            max_index = (index + count - 1 > max_index) ? index + count - 1
+                                                        : max_index;
+            break;
+        case 'F':
+            ignore += fscanf(tracefile, "%u %u", &index, &count);
+            if (count == 0)
+                app_error("Empty batch in tracefile %s\n", trace->filename);
+            trace->ops[op_index].type = BATCH_FREE;
+            trace->ops[op_index].index = index;
+            break;
         default:
             app_error("Bogus type character (%c) in tracefile %s\n", type[0],
                       trace->filename);
         }
+        trace->ops[op_index].count = count;
+        max_count = (count > max_count) ? count : max_count;
+        requests += count;
         op_index++;
         if (op_index == trace->num_ops)
             break;
@@ -1026,10 +1128,14 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     assert(max_index == trace->num_ids - 1);
     assert(trace->num_ops == op_index);
 
+    /* Batch requests hand their pointers to the allocator in one array */
+    if ((trace->batch = calloc(max_count, sizeof(*trace->batch))) == NULL)
+        unix_error("malloc 6 failed in read_trace");
+
     /* fill in the stats */
     strcpy(stats->filename, trace->filename);
     stats->weight = trace->weight;
-    stats->ops = trace->num_ops;
+    stats->ops = (double)requests;
 
     return trace;
 }
@@ -1044,14 +1150,15 @@ static void reinit_trace(trace_t *trace) {
 }
 
 /*
- * free_trace - Free the trace record and the four arrays it points
+ * free_trace - Free the trace record and the five arrays it points
  *              to, all of which were allocated in read_trace().
  */
 static void free_trace(trace_t *trace) {
-    free(trace->ops); /* free the three arrays... */
+    free(trace->ops); /* free the five arrays... */
     free(trace->blocks);
     free(trace->block_sizes);
     free(trace->block_rand_base);
+    free(trace->batch);
     free(trace); /* and the trace record itself... */
 }
 
@@ -1064,8 +1171,8 @@ static void free_trace(trace_t *trace) {
  * eval_mm_valid - Check the mm malloc package for correctness
  */
 static bool eval_mm_valid(trace_t *trace, range_set_t *ranges) {
-    unsigned int i;
-    unsigned int index;
+    unsigned int i, j;
+    unsigned int index, count;
     size_t size;
     char *newp;
     char *oldp;
@@ -1108,11 +1215,18 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges) {
 
         switch (trace->ops[i].type) {
 
-        case ALLOC: /* mm_malloc */
+        case ALLOC:         /* mm_malloc */
+        case ALIGNED_ALLOC: /* mm_memalign */
 
             /* Call the student's malloc */
-            if ((p = mm_malloc(size)) == NULL) {
-                malloc_error(trace, i, "mm_malloc failed.");
+            if (trace->ops[i].type == ALLOC)
+                p = mm_malloc(size);
+            else
+                p = mm_memalign(trace->ops[i].align, size);
+            if (p == NULL) {
+                malloc_error(trace, i, "%s failed.",
+                             trace->ops[i].type == ALLOC ? "mm_malloc"
+                                                         : "mm_memalign");
                 return false;
             }
 
@@ -1121,7 +1235,8 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges) {
              * to the range list if OK. The block must be  be aligned properly,
              * and must not overlap any currently allocated block.
              */
-            if (add_range(ranges, p, size, trace, i, index) == 0)
+            if (add_range(ranges, p, size, trace->ops[i].align, trace, i,
+                          index) == 0)
                 return false;
 
             /* Remember region */
@@ -1158,7 +1273,8 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges) {
 
             /* Check new block for correctness and add it to range list */
             if (size > 0) {
-                if (add_range(ranges, newp, size, trace, i, index) == 0)
+                if (add_range(ranges, newp, size, ALIGNMENT, trace, i,
+                              index) == 0)
                     return false;
             }
 
@@ -1195,6 +1311,38 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges) {
             mm_free(p);
             break;
 
+        case BATCH_ALLOC: /* mm_malloc_batch */
+            count = trace->ops[i].count;
+            if (mm_malloc_batch(size, trace->batch, count) != count) {
+                malloc_error(trace, i, "mm_malloc_batch failed.");
+                return false;
+            }
+
+            /* Each block of the batch is checked as if malloc returned it */
+            for (j = 0; j < count; j++) {
+                p = trace->batch[j];
+                if (add_range(ranges, p, size, ALIGNMENT, trace, i,
+                              index + j) == 0)
+                    return false;
+                trace->blocks[index + j] = p;
+                trace->block_sizes[index + j] = size;
+                randomize_block(trace, index + j);
+            }
+            break;
+
+        case BATCH_FREE: /* mm_free_batch */
+            count = trace->ops[i].count;
+            for (j = 0; j < count; j++) {
+                if (!check_index(trace, i, index + j)) {
+                    allCheck = false;
+                }
+                p = trace->blocks[index + j];
+                remove_range(ranges, p);
+                trace->batch[j] = p;
+            }
+            mm_free_batch(trace->batch, count);
+            break;
+
         default:
             app_error("Nonexistent request type in eval_mm_valid");
         }
@@ -1207,17 +1355,15 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges) {
  * eval_mm_util - Evaluate the space utilization of the student's package
  *   The idea is to remember the high water mark "hwm" of the heap for
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
- *   Utilization is the ratio hwm/heapsize, where heapsize is the
- *   size of the heap in bytes after running the student's malloc
- *   package on the trace. Note that our implementation of mem_sbrk()
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap.
+ *   Utilization is the ratio hwm/footprint, where footprint is the
+ *   largest number of bytes the student's malloc package held at once,
+ *   counting both the heap and any regions mapped with mem_map().
  *
  *   A higher number is better: 1 is optimal.
  */
 static double eval_mm_util(trace_t *trace, size_t tracenum) {
-    unsigned int i;
-    unsigned int index;
+    unsigned int i, j;
+    unsigned int index, count;
     size_t size, newsize, oldsize;
     size_t max_total_size = 0;
     size_t total_size = 0;
@@ -1234,13 +1380,19 @@ static double eval_mm_util(trace_t *trace, size_t tracenum) {
     for (i = 0; i < trace->num_ops; i++) {
         switch (trace->ops[i].type) {
 
-        case ALLOC: /* mm_alloc */
+        case ALLOC:         /* mm_alloc */
+        case ALIGNED_ALLOC: /* mm_memalign */
             index = trace->ops[i].index;
             size = trace->ops[i].size;
 
-            if ((p = mm_malloc(size)) == NULL) {
-                app_error("trace %zd: mm_malloc failed in eval_mm_util",
-                          tracenum);
+            if (trace->ops[i].type == ALLOC)
+                p = mm_malloc(size);
+            else
+                p = mm_memalign(trace->ops[i].align, size);
+            if (p == NULL) {
+                app_error("trace %zd: %s failed in eval_mm_util", tracenum,
+                          trace->ops[i].type == ALLOC ? "mm_malloc"
+                                                      : "mm_memalign");
             }
 
             /* Remember region and size */
@@ -1285,6 +1437,36 @@ static double eval_mm_util(trace_t *trace, size_t tracenum) {
             total_size -= size;
             break;
 
+        case BATCH_ALLOC: /* mm_malloc_batch */
+            index = trace->ops[i].index;
+            count = trace->ops[i].count;
+            size = trace->ops[i].size;
+
+            if (mm_malloc_batch(size, trace->batch, count) != count) {
+                app_error("trace %zd: mm_malloc_batch failed in eval_mm_util",
+                          tracenum);
+            }
+
+            for (j = 0; j < count; j++) {
+                trace->blocks[index + j] = trace->batch[j];
+                trace->block_sizes[index + j] = size;
+            }
+
+            total_size += size * count;
+            break;
+
+        case BATCH_FREE: /* mm_free_batch */
+            index = trace->ops[i].index;
+            count = trace->ops[i].count;
+
+            for (j = 0; j < count; j++) {
+                trace->batch[j] = trace->blocks[index + j];
+                total_size -= trace->block_sizes[index + j];
+            }
+
+            mm_free_batch(trace->batch, count);
+            break;
+
         default:
             app_error("trace %zd: Nonexistent request type in eval_mm_util",
                       tracenum);
@@ -1295,7 +1477,7 @@ static double eval_mm_util(trace_t *trace, size_t tracenum) {
             (total_size > max_total_size) ? total_size : max_total_size;
     }
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    return ((double)max_total_size / (double)mem_peaksize());
 }
 
 /*
@@ -1303,7 +1485,7 @@ static double eval_mm_util(trace_t *trace, size_t tracenum) {
  *    to measure the running time of the mm malloc package.
  */
 static void eval_mm_speed(void *ptr) {
-    unsigned int i, index;
+    unsigned int i, j, index, count;
     size_t size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
@@ -1326,6 +1508,14 @@ static void eval_mm_speed(void *ptr) {
             trace->blocks[index] = p;
             break;
 
+        case ALIGNED_ALLOC: /* mm_memalign */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            if ((p = mm_memalign(trace->ops[i].align, size)) == NULL)
+                app_error("mm_memalign error in eval_mm_speed");
+            trace->blocks[index] = p;
+            break;
+
         case REALLOC: /* mm_realloc */
             index = trace->ops[i].index;
             newsize = trace->ops[i].size;
@@ -1347,6 +1537,24 @@ static void eval_mm_speed(void *ptr) {
             mm_free(block);
             break;
 
+        case BATCH_ALLOC: /* mm_malloc_batch */
+            index = trace->ops[i].index;
+            count = trace->ops[i].count;
+            size = trace->ops[i].size;
+            if (mm_malloc_batch(size, trace->batch, count) != count)
+                app_error("mm_malloc_batch error in eval_mm_speed");
+            for (j = 0; j < count; j++)
+                trace->blocks[index + j] = trace->batch[j];
+            break;
+
+        case BATCH_FREE: /* mm_free_batch */
+            index = trace->ops[i].index;
+            count = trace->ops[i].count;
+            for (j = 0; j < count; j++)
+                trace->batch[j] = trace->blocks[index + j];
+            mm_free_batch(trace->batch, count);
+            break;
+
         default:
             app_error("Nonexistent request type in eval_mm_speed");
         }
@@ -1359,7 +1567,7 @@ static void eval_mm_speed(void *ptr) {
  *
  */
 static bool eval_libc_valid(trace_t *trace) {
-    unsigned int i;
+    unsigned int i, j;
     size_t newsize;
     char *p, *newp, *oldp;
 
@@ -1376,6 +1584,15 @@ static bool eval_libc_valid(trace_t *trace) {
             trace->blocks[trace->ops[i].index] = p;
             break;
 
+        case ALIGNED_ALLOC: /* aligned_alloc */
+            if ((p = aligned_alloc(trace->ops[i].align, trace->ops[i].size)) ==
+                NULL) {
+                malloc_error(trace, i, "libc aligned_alloc failed");
+                unix_error("System message");
+            }
+            trace->blocks[trace->ops[i].index] = p;
+            break;
+
         case REALLOC: /* realloc */
             newsize = trace->ops[i].size;
             oldp = trace->blocks[trace->ops[i].index];
@@ -1394,6 +1611,21 @@ static bool eval_libc_valid(trace_t *trace) {
             }
             break;
 
+        case BATCH_ALLOC: /* one malloc per block */
+            for (j = 0; j < trace->ops[i].count; j++) {
+                if ((p = malloc(trace->ops[i].size)) == NULL) {
+                    malloc_error(trace, i, "libc malloc failed");
+                    unix_error("System message");
+                }
+                trace->blocks[trace->ops[i].index + j] = p;
+            }
+            break;
+
+        case BATCH_FREE: /* one free per block */
+            for (j = 0; j < trace->ops[i].count; j++)
+                free(trace->blocks[trace->ops[i].index + j]);
+            break;
+
         default:
             app_error("invalid operation type  in eval_libc_valid");
         }
@@ -1408,7 +1640,7 @@ static bool eval_libc_valid(trace_t *trace) {
  *    of traces.
  */
 static void eval_libc_speed(void *ptr) {
-    unsigned int i;
+    unsigned int i, j;
     unsigned int index;
     size_t size, newsize;
     char *p, *newp, *oldp, *block;
@@ -1426,6 +1658,14 @@ static void eval_libc_speed(void *ptr) {
             trace->blocks[index] = p;
             break;
 
+        case ALIGNED_ALLOC: /* aligned_alloc */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            if ((p = aligned_alloc(trace->ops[i].align, size)) == NULL)
+                unix_error("aligned_alloc failed in eval_libc_speed");
+            trace->blocks[index] = p;
+            break;
+
         case REALLOC: /* realloc */
             index = trace->ops[i].index;
             newsize = trace->ops[i].size;
@@ -1445,6 +1685,22 @@ static void eval_libc_speed(void *ptr) {
                 free(0);
             }
             break;
+
+        case BATCH_ALLOC: /* one malloc per block */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            for (j = 0; j < trace->ops[i].count; j++) {
+                if ((p = malloc(size)) == NULL)
+                    unix_error("malloc failed in eval_libc_speed");
+                trace->blocks[index + j] = p;
+            }
+            break;
+
+        case BATCH_FREE: /* one free per block */
+            index = trace->ops[i].index;
+            for (j = 0; j < trace->ops[i].count; j++)
+                free(trace->blocks[index + j]);
+            break;
         }
     }
 }
@@ -1455,9 +1711,11 @@ static void eval_libc_speed(void *ptr) {
 
 /*
  * printresults - prints a performance summary for some malloc package and
- * returns a summary of the stats to the caller.
+ * returns a summary of the stats to the caller. With show_sbrks, each
+ * trace also shows how often the heap grew.
  */
-static void printresults(size_t n, stats_t *stats, sum_stats_t *sumstats) {
+static void printresults(size_t n, stats_t *stats, sum_stats_t *sumstats,
+                         bool show_sbrks) {
     size_t i;
 
     /* weighted sums all */
@@ -1473,10 +1731,11 @@ static void printresults(size_t n, stats_t *stats, sum_stats_t *sumstats) {
 
     /* Print the individual results for each trace */
     if (tab_mode) {
-        printf("valid\tthru?\tutil?\tutil\tops\tmsecs\tKops/s\ttrace\n");
+        printf("valid\tthru?\tutil?\tutil\tops\tmsecs\tKops/s\t%strace\n",
+               show_sbrks ? "sbrks\t" : "");
     } else {
-        printf("  %5s  %6s %7s%8s%8s  %s\n", "valid", "util", "ops", "msecs",
-               "Kops/s", "trace");
+        printf("  %5s  %6s %7s%8s%8s  %s%s\n", "valid", "util", "ops", "msecs",
+               "Kops/s", show_sbrks ? " sbrks " : "", "trace");
     }
     for (i = 0; i < n; i++) {
         if (stats[i].valid) {
@@ -1537,6 +1796,14 @@ static void printresults(size_t n, stats_t *stats, sum_stats_t *sumstats) {
                     printf("%8s%10s%7s ", "--", "--", "--");
             }
 
+            /* Heap growth */
+            if (show_sbrks) {
+                if (tab_mode)
+                    printf("%zu\t", stats[i].sbrks);
+                else
+                    printf("%6zu ", stats[i].sbrks);
+            }
+
             printf("%s\n", stats[i].filename);
 
             if (stats[i].weight == WALL || stats[i].weight == WPERF) {
@@ -1601,6 +1868,62 @@ static void printresults(size_t n, stats_t *stats, sum_stats_t *sumstats) {
     }
 }
 
+/*
+ * print_bin_stats - prints the per-list counters of the mm package after
+ * a correctness run, skipping lists that were never used.
+ */
+static void print_bin_stats(void) {
+    size_t n = mm_bin_stats(NULL, 0);
+    mm_bin_stats_t *bins = (mm_bin_stats_t *)calloc(n, sizeof(*bins));
+    if (bins == NULL)
+        unix_error("calloc failed in print_bin_stats");
+    mm_bin_stats(bins, n);
+    printf("\n  %4s %10s %10s %10s\n", "bin", "free", "bytes",
+           "fit hits");
+    for (size_t i = 0; i < n; i++) {
+        if (bins[i].free_blocks == 0 && bins[i].fit_hits == 0)
+            continue;
+        printf("  %4zu %10zu %10zu %10zu\n", i, bins[i].free_blocks,
+               bins[i].free_bytes, bins[i].fit_hits);
+    }
+    free(bins);
+}
+
+/*
+ * print_mm_stats - Print the mm package's counters after a trace has run,
+ * followed by the free blocks and bytes of each of its lists
+ */
+static void print_mm_stats(const char *filename) {
+    mm_stats_t st;
+    printf("\nstats for %s:\n", filename);
+    if (!mm_stats(&st)) {
+        printf("  heap size %zu (build mm.c with MM_STATS for the rest)\n",
+               st.heap_size);
+        print_bin_stats();
+        return;
+    }
+    printf("  mallocs %zu, frees %zu, reallocs %zu\n", st.mallocs, st.frees,
+           st.reallocs);
+    printf("  bytes in use %zu, heap size %zu\n", st.bytes_in_use,
+           st.heap_size);
+    printf("  splits %zu, coalesces %zu, heap extensions %zu\n", st.splits,
+           st.coalesces, st.extends);
+    printf("  fit searches by blocks looked at:");
+    for (size_t i = 0; i < MM_SEARCH_BUCKETS; i++) {
+        if (i == 0)
+            printf(" 0: %zu", st.searches[i]);
+        else if (i == 1)
+            printf(", 1: %zu", st.searches[i]);
+        else if (i == MM_SEARCH_BUCKETS - 1)
+            printf(", %zu+: %zu", (size_t)1 << (i - 1), st.searches[i]);
+        else
+            printf(", %zu-%zu: %zu", (size_t)1 << (i - 1),
+                   ((size_t)1 << i) - 1, st.searches[i]);
+    }
+    printf("\n");
+    print_bin_stats();
+}
+
 /*
  * app_error - Report an arbitrary application error
  */
@@ -1814,5 +2137,13 @@ static void usage(char *prog) {
     fprintf(stderr, "\t-v <i>     Set Verbosity Level to <i>\n");
     fprintf(stderr, "\t-s <s>     Timeout after s secs (default no timeout)\n");
     fprintf(stderr, "\t-T         Print diagnostics in tab mode\n");
+    fprintf(stderr, "\t-S         Print the allocator's counters after "
+                    "each trace\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file\n");
+    fprintf(stderr, "\t-M <n>     Map requests of at least n bytes outside "
+                    "the heap\n");
+    fprintf(stderr, "\t-G <p>     Grow the heap by the fixed or adaptive "
+                    "policy\n");
+    fprintf(stderr, "\t-o <n>     Keep free blocks of at least n bytes in "
+                    "address order\n");
 }
@@ -31,6 +31,12 @@
  *  in non-emulation, as it was to the same page as actual heap data.  But
  *  sparse emulation has tighter checks.  Commonly, the CPU reports a
  *  BUS ERROR on these accesses, and should be debugged as segmentation faults.
+ *
+ * Besides the brk heap, the model hands out page-aligned mappings, a simple
+ *  model of mmap.  Mappings are carved top-down from the end of the same
+ *  address range the heap grows up into, so the two can never overlap, and
+ *  are emulated exactly like heap bytes.  The footprint of a run is the
+ *  largest total of heap and mapped bytes ever held at once.
  */
 #define _XOPEN_SOURCE 700
 #include <assert.h>
@@ -69,10 +75,21 @@ typedef struct MBLK {
     unsigned char bytes[SPARSE_PAGE_SIZE]; /* Page contents */
 } mem_block_t;
 
+/* A live mapping made by mem_map */
+typedef struct {
+    unsigned char *start; /* Page-aligned first byte */
+    size_t len;           /* Length in bytes, a multiple of the page size */
+} mem_mapping_t;
+
+/* Most mappings that can be live at once */
+#define MAX_MAPPINGS 4096
+
 /* private global variables */
 static bool sparse = false;         /* Use sparse memory emulation */
 static unsigned char *heap;         /* Starting address of heap */
 static unsigned char *mem_brk;      /* Current position of break */
+static unsigned char *mem_dirty;    /* Highest break since the last reset */
+static unsigned char *mem_used;     /* Highest break since mem_init */
 static unsigned char *mem_max_addr; /* Maximum allowable heap address */
 static size_t mmap_length =
     MAX_DENSE_HEAP; /* Number of bytes allocated by mmap */
@@ -80,6 +97,14 @@ static bool show_stats =
     false; /* Should program print allocation information? */
 static bool stats_printed =
     false; /* Has information been printed about allocation */
+static int dev_zero = -1; /* /dev/zero, which backs the dense heap */
+
+/* Mappings, sorted by descending start address */
+static mem_mapping_t mappings[MAX_MAPPINGS];
+static size_t num_mappings = 0;  /* Number of live mappings */
+static size_t mapped_bytes = 0;  /* Total length of the live mappings */
+static size_t peak_bytes = 0;    /* Largest heap plus mapped size seen */
+static size_t sbrk_calls = 0;    /* Calls that grew the heap since reset */
 
 /* Sparse memory representation */
 static mem_block_t *next_free_page = NULL; /* Next free page */
@@ -117,6 +142,10 @@ static size_t page_id(const void *addr);
 static void *page_start(size_t id);
 static void *get_mem(const void *addr, size_t, bool);
 static void print_stats(void);
+static bool emulated(const void *addr, size_t len);
+static unsigned char *map_floor(void);
+static void update_peak(void);
+static void release_pages(unsigned char *start, size_t len);
 
 /*
  * mem_init - initialize the memory system model
@@ -145,7 +174,8 @@ void mem_init(bool do_sparse) {
         mmap_length = MAX_DENSE_HEAP;
     }
 
-    int dev_zero = open("/dev/zero", O_RDWR);
+    if (dev_zero < 0)
+        dev_zero = open("/dev/zero", O_RDWR);
     void *start = sparse ? NULL : TRY_DENSE_HEAP_START;
     void *addr = mmap(start,                  /* suggested start*/
                       mmap_length,            /* length */
@@ -168,6 +198,12 @@ void mem_init(bool do_sparse) {
     }
     stats_printed = false;
     mem_brk = heap;
+    mem_dirty = heap;
+    mem_used = heap;
+    num_mappings = 0;
+    mapped_bytes = 0;
+    peak_bytes = 0;
+    sbrk_calls = 0;
 }
 
 /*
@@ -195,6 +231,9 @@ void mem_reset_brk(void) {
         next_free_page = (mem_block_t *)((unsigned char *)page_table + ptb);
         num_free_pages = num_pages;
     } else {
+        /* Mappings left live must read as zero when they are made again */
+        for (size_t i = 0; i < num_mappings; i++)
+            release_pages(mappings[i].start, mappings[i].len);
 #ifdef USE_ASAN
         /* Mark the entire heap as unaddressable */
         __asan_poison_memory_region(heap, MAX_DENSE_HEAP);
@@ -209,24 +248,30 @@ void mem_reset_brk(void) {
 #endif
     }
     mem_brk = heap;
+    mem_dirty = heap;
+    num_mappings = 0;
+    mapped_bytes = 0;
+    peak_bytes = 0;
+    sbrk_calls = 0;
 }
 
 /*
  * mem_sbrk - simple model of the sbrk function. Extends the heap
  *                by incr bytes and returns the start address of the new area.
- * In this model, the heap cannot be shrunk.
+ * A negative incr shrinks the heap; in the dense model, the bytes given back
+ * read as zero if the heap grows over them again.
  */
 void *mem_sbrk(intptr_t incr) {
     unsigned char *old_brk = mem_brk;
 
     bool ok = true;
-    if (incr < 0) {
+    if (incr < 0 && (size_t)-incr > (size_t)(mem_brk - heap)) {
         ok = false;
         fprintf(stderr,
-                "ERROR: mem_sbrk failed.  Attempt to expand heap by negative "
-                "value %ld\n",
-                (long)incr);
-    } else if (mem_brk + incr > mem_max_addr) {
+                "ERROR: mem_sbrk failed.  Attempt to shrink heap by %ld "
+                "bytes, below its start\n",
+                -(long)incr);
+    } else if (incr > 0 && mem_brk + incr > map_floor()) {
         ok = false;
         ptrdiff_t alloc = mem_brk - heap + incr;
         fprintf(stderr,
@@ -235,7 +280,10 @@ void *mem_sbrk(intptr_t incr) {
                 alloc, alloc);
     }
 #if !defined DEBUG && !defined USE_MSAN && !defined USE_ASAN
-    else if (!sparse && sbrk(incr) == (void *)-1) {
+    /* Only growth past the highest break so far is mirrored, since libc
+       malloc may own memory above ours: trims and regrowth stay below it */
+    else if (!sparse && mem_brk + incr > mem_used &&
+             sbrk(mem_brk + incr - mem_used) == (void *)-1) {
         ok = false;
         fprintf(
             stderr,
@@ -243,12 +291,33 @@ void *mem_sbrk(intptr_t incr) {
     }
 #endif
 
-    if (ok) {
+    if (ok && incr < 0) {
+        mem_brk += incr;
+#ifdef USE_ASAN
+        /* Mark the released section of the heap as unaddressable */
+        __asan_poison_memory_region(mem_brk, (size_t)-incr);
+#endif
+        return (void *)old_brk;
+    } else if (ok) {
 #ifdef USE_ASAN
         /* Mark the extended section of the heap as addressable */
         __asan_unpoison_memory_region(mem_brk, (size_t)incr);
 #endif
+        /* Bytes given back by an earlier shrink are zeroed as they are
+           handed out again */
+        if (!sparse && mem_brk < mem_dirty) {
+            unsigned char *end = mem_brk + incr < mem_dirty ? mem_brk + incr
+                                                            : mem_dirty;
+            memset(mem_brk, 0, (size_t)(end - mem_brk));
+        }
         mem_brk += incr;
+        if (incr > 0)
+            sbrk_calls++;
+        if (mem_brk > mem_dirty)
+            mem_dirty = mem_brk;
+        if (mem_brk > mem_used)
+            mem_used = mem_brk;
+        update_peak();
         return (void *)old_brk;
     } else {
         errno = ENOMEM;
@@ -270,6 +339,14 @@ void *mem_heap_hi(void) {
     return (void *)(mem_brk - 1);
 }
 
+/*
+ * mem_sbrk_calls - returns the number of mem_sbrk calls that grew the heap
+ *    since it was last reset
+ */
+size_t mem_sbrk_calls(void) {
+    return sbrk_calls;
+}
+
 /*
  * mem_heapsize() - returns the heap size in bytes
  */
@@ -277,6 +354,155 @@ size_t mem_heapsize(void) {
     return (size_t)(mem_brk - heap);
 }
 
+/*
+ * mem_map - simple model of an anonymous mmap.  Returns a page-aligned
+ *    region of at least len bytes, placed at the highest free address below
+ *    the existing mappings that does not collide with the heap.
+ */
+void *mem_map(size_t len) {
+    size_t page = mem_pagesize();
+    len = (len + page - 1) / page * page;
+
+    unsigned char *top = mem_max_addr;
+    size_t i;
+    for (i = 0; i < num_mappings; i++) {
+        unsigned char *end = mappings[i].start + mappings[i].len;
+        if (len != 0 && (size_t)(top - end) >= len)
+            break;
+        top = mappings[i].start;
+    }
+    if (len == 0 || num_mappings == MAX_MAPPINGS ||
+        (i == num_mappings && (size_t)(top - mem_brk) < len)) {
+        fprintf(stderr,
+                "ERROR: mem_map failed.  Could not map %zu (0x%zx) bytes\n",
+                len, len);
+        errno = ENOMEM;
+        return (void *)-1;
+    }
+
+    memmove(&mappings[i + 1], &mappings[i],
+            (num_mappings - i) * sizeof(mem_mapping_t));
+    mappings[i].start = top - len;
+    mappings[i].len = len;
+    num_mappings++;
+    mapped_bytes += len;
+    update_peak();
+#ifdef USE_ASAN
+    __asan_unpoison_memory_region(top - len, len);
+#endif
+#ifdef USE_MSAN
+    __msan_allocated_memory(top - len, len);
+#endif
+    return (void *)(top - len);
+}
+
+/*
+ * mem_unmap - release a mapping made by mem_map.  The whole mapping must be
+ *    released at once.
+ */
+void mem_unmap(void *addr, size_t len) {
+    size_t page = mem_pagesize();
+    len = (len + page - 1) / page * page;
+    for (size_t i = 0; i < num_mappings; i++) {
+        if (mappings[i].start == addr) {
+            assert(mappings[i].len == len);
+            release_pages(mappings[i].start, len);
+            mapped_bytes -= len;
+            num_mappings--;
+            memmove(&mappings[i], &mappings[i + 1],
+                    (num_mappings - i) * sizeof(mem_mapping_t));
+            return;
+        }
+    }
+    fprintf(stderr, "ERROR: mem_unmap failed.  %p is not a mapping\n", addr);
+}
+
+/*
+ * mem_remap - resize a mapping made by mem_map in place, like mremap without
+ *    MREMAP_MAYMOVE.  Shrinking always succeeds; growing needs the pages
+ *    just above the mapping to be free.
+ */
+void *mem_remap(void *addr, size_t old_len, size_t new_len) {
+    size_t page = mem_pagesize();
+    old_len = (old_len + page - 1) / page * page;
+    new_len = (new_len + page - 1) / page * page;
+    for (size_t i = 0; i < num_mappings; i++) {
+        if (mappings[i].start != addr)
+            continue;
+        assert(mappings[i].len == old_len);
+        unsigned char *top = i == 0 ? mem_max_addr : mappings[i - 1].start;
+        if (new_len == 0 || (size_t)(top - mappings[i].start) < new_len) {
+            errno = ENOMEM;
+            return (void *)-1;
+        }
+        if (new_len < old_len) {
+            release_pages(mappings[i].start + new_len, old_len - new_len);
+        } else {
+#ifdef USE_ASAN
+            __asan_unpoison_memory_region(mappings[i].start + old_len,
+                                          new_len - old_len);
+#endif
+#ifdef USE_MSAN
+            __msan_allocated_memory(mappings[i].start + old_len,
+                                    new_len - old_len);
+#endif
+        }
+        mappings[i].len = new_len;
+        mapped_bytes = mapped_bytes - old_len + new_len;
+        update_peak();
+        return addr;
+    }
+    fprintf(stderr, "ERROR: mem_remap failed.  %p is not a mapping\n", addr);
+    errno = EINVAL;
+    return (void *)-1;
+}
+
+/*
+ * mem_map_lo - return address of the first byte of the lowest mapping, or
+ *    the end of the address range if there is none
+ */
+void *mem_map_lo(void) {
+    return (void *)map_floor();
+}
+
+/*
+ * mem_map_hi - return address of the last byte of the highest mapping
+ */
+void *mem_map_hi(void) {
+    if (num_mappings == 0)
+        return (void *)(mem_max_addr - 1);
+    return (void *)(mappings[0].start + mappings[0].len - 1);
+}
+
+/*
+ * mem_mapsize() - returns the number of bytes currently mapped
+ */
+size_t mem_mapsize(void) {
+    return mapped_bytes;
+}
+
+/*
+ * mem_peaksize() - returns the largest heap plus mapped size since the last
+ *    reset
+ */
+size_t mem_peaksize(void) {
+    return peak_bytes;
+}
+
+/*
+ * mem_fresh_lo() - returns the address from which heap and mapped bytes
+ *    have never held data: the highest break since mem_init.  Nothing is
+ *    fresh in the sparse model or under MSan, which track uninitialized
+ *    bytes instead.
+ */
+void *mem_fresh_lo(void) {
+#ifndef USE_MSAN
+    if (!sparse)
+        return (void *)mem_used;
+#endif
+    return (void *)mem_max_addr;
+}
+
 /*
  * mem_pagesize() - returns the page size of the system
  */
@@ -301,8 +527,7 @@ void mem_write128(void *addr, __int128_t val) {
 /* Read len bytes and return value zero-extended to 64 bits */
 uint64_t mem_read(const void *addr, size_t len) {
     uint64_t rdata;
-    if (sparse && (unsigned char *)addr >= heap &&
-        (unsigned char *)addr + len <= mem_brk) {
+    if (sparse && emulated(addr, len)) {
         /* Heap read.  Check if it crosses page boundary */
         size_t id = page_id(addr);
         void *paddr = get_mem(addr, len, false);
@@ -340,8 +565,7 @@ uint64_t mem_read(const void *addr, size_t len) {
 
 /* Write lower order len bytes of val to address */
 void mem_write(void *addr, uint64_t val, size_t len) {
-    if (sparse && (unsigned char *)addr >= heap &&
-        (unsigned char *)addr + len <= mem_brk) {
+    if (sparse && emulated(addr, len)) {
         /* Heap write.  Check to see if it crosses page boundary */
         size_t id = page_id(addr);
         void *paddr = get_mem(addr, len, true);
@@ -396,25 +620,57 @@ void *mem_memcpy(void *dst, const void *src, size_t num_bytes) {
     return savedst;
 }
 
-/* Emulation of memset */
-void *mem_memset(void *dst, int c, size_t num_bytes) {
-    void *savedst = dst;
-    uint64_t byte = c & 0xFF;
-    uint64_t data = 0;
+/* Emulation of memmove.  Copies a word at a time in the direction that
+ * never overwrites source bytes before they are read, falling back to
+ * single bytes when the regions are less than a word apart. */
+void *mem_memmove(void *dst, const void *src, size_t num_bytes) {
+    unsigned char *d = (unsigned char *)dst;
+    const unsigned char *s = (const unsigned char *)src;
     size_t word_size = sizeof(uint64_t);
-    size_t i;
-    for (i = 0; i < word_size; i++) {
-        data = data | (byte << (8 * i));
-    }
-    while (num_bytes >= word_size) {
-        mem_write(dst, data, word_size);
-        num_bytes -= word_size;
-        dst = (void *)((unsigned char *)dst + word_size);
+    size_t step = word_size;
+    if (d == s || num_bytes == 0)
+        return dst;
+    if ((d < s && (size_t)(s - d) < word_size) ||
+        (d > s && (size_t)(d - s) < word_size))
+        step = 1;
+    if (d < s || d >= s + num_bytes) {
+        while (num_bytes > 0) {
+            size_t len = num_bytes < step ? num_bytes : step;
+            mem_write(d, mem_read(s, len), len);
+            num_bytes -= len;
+            d += len;
+            s += len;
+        }
+    } else {
+        d += num_bytes;
+        s += num_bytes;
+        while (num_bytes > 0) {
+            size_t len = num_bytes < step ? num_bytes : step;
+            d -= len;
+            s -= len;
+            mem_write(d, mem_read(s, len), len);
+            num_bytes -= len;
+        }
     }
-    if (num_bytes) {
-        mem_write(dst, data, num_bytes);
+    return dst;
+}
+
+/* Emulation of memset.  Fills a page at a time, so that large clears run
+ * at the speed of the C library's memset rather than a word at a time */
+void *mem_memset(void *dst, int c, size_t num_bytes) {
+    if (!sparse || !emulated(dst, num_bytes))
+        return memset(dst, c, num_bytes);
+    unsigned char *d = (unsigned char *)dst;
+    while (num_bytes > 0) {
+        ptrdiff_t offset = d - (unsigned char *)page_start(page_id(d));
+        size_t len = SPARSE_PAGE_SIZE - (size_t)offset;
+        if (len > num_bytes)
+            len = num_bytes;
+        memset(get_mem(d, len, true), c, len);
+        num_bytes -= len;
+        d += len;
     }
-    return savedst;
+    return dst;
 }
 
 /* Function to aid in viewing contents of heap */
@@ -460,9 +716,48 @@ static void print_stats(void) {
         printf("Allocated %zu heap bytes.  Max address = %p\n", vbytes,
                (void *)mem_brk);
     }
+    if (peak_bytes > vbytes)
+        printf("Peak footprint %zu bytes, including mappings\n", peak_bytes);
     stats_printed = true;
 }
 
+/* Does an access fall in the heap or in a mapping, i.e. in emulated memory? */
+static bool emulated(const void *addr, size_t len) {
+    unsigned char *lo = (unsigned char *)addr;
+    if (lo >= heap && lo + len <= mem_brk)
+        return true;
+    for (size_t i = 0; i < num_mappings; i++) {
+        if (lo >= mappings[i].start)
+            return lo + len <= mappings[i].start + mappings[i].len;
+    }
+    return false;
+}
+
+/* Lowest mapped address, which bounds the growth of the heap */
+static unsigned char *map_floor(void) {
+    if (num_mappings == 0)
+        return mem_max_addr;
+    return mappings[num_mappings - 1].start;
+}
+
+/* Raise the footprint high-water mark to the current heap plus mappings */
+static void update_peak(void) {
+    size_t total = mem_heapsize() + mapped_bytes;
+    if (total > peak_bytes)
+        peak_bytes = total;
+}
+
+/* Hand released heap or mapping pages back, so they read as zero and are
+ * unaddressable until handed out again */
+static void release_pages(unsigned char *start, size_t len) {
+    if (!sparse)
+        mmap(start, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+             dev_zero, 0);
+#ifdef USE_ASAN
+    __asan_poison_memory_region(start, len);
+#endif
+}
+
 /* Given an address, compute the ID  of its page */
 static size_t page_id(const void *addr) {
     ptrdiff_t offset =
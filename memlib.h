@@ -26,13 +26,14 @@ void mem_deinit(void);
 /**
  * @brief Extends the heap by incr bytes.
  *
- * This function is a simple model of the sbrk() function, except for that
- * with this implementation, the heap cannot be shrunk.
+ * This function is a simple model of the sbrk() function. A negative incr
+ * shrinks the heap, giving the top -incr bytes back; with a dense heap they
+ * read as zero if the heap later grows over them again.
  *
  * @param[in] incr The amount of bytes by which to extend the heap
  * @return The start address of the new heap area (i.e. the previous
  *         breakpoint)
- * @pre `incr > 0`
+ * @pre `-incr <= mem_heapsize()`
  */
 void *mem_sbrk(intptr_t incr);
 
@@ -63,6 +64,81 @@ void *mem_heap_hi(void);
  */
 size_t mem_heapsize(void);
 
+/**
+ * @brief Maps a fresh region outside the heap.
+ *
+ * This function is a simple model of an anonymous mmap(). The region is
+ * page-aligned, never overlaps the heap, and is counted in the footprint
+ * until it is released with mem_unmap.
+ *
+ * @param[in] len The number of bytes to map, rounded up to whole pages
+ * @return The start address of the region, or (void *)-1 on failure
+ */
+void *mem_map(size_t len);
+
+/**
+ * @brief Releases a region returned by mem_map.
+ * @param[in] addr The start address of the region
+ * @param[in] len  The region's current length
+ */
+void mem_unmap(void *addr, size_t len);
+
+/**
+ * @brief Resizes a region returned by mem_map without moving it.
+ *
+ * Like mremap() without MREMAP_MAYMOVE: shrinking always succeeds, and
+ * growing succeeds when the pages just above the region are not mapped.
+ *
+ * @param[in] addr    The start address of the region
+ * @param[in] old_len The region's current length
+ * @param[in] new_len The length wanted, rounded up to whole pages
+ * @return addr on success, or (void *)-1 if the region cannot grow in place
+ */
+void *mem_remap(void *addr, size_t old_len, size_t new_len);
+
+/**
+ * @brief Finds the low address of the mapped regions.
+ * @return The first byte of the lowest mapping
+ */
+void *mem_map_lo(void);
+
+/**
+ * @brief Finds the high address of the mapped regions.
+ * @return The last byte of the highest mapping
+ */
+void *mem_map_hi(void);
+
+/**
+ * @brief Returns the number of bytes currently mapped with mem_map.
+ * @return The total length of the live mappings, in bytes
+ */
+size_t mem_mapsize(void);
+
+/**
+ * @brief Returns the footprint high-water mark since the heap was reset.
+ * @return The largest heap size plus mapped size held at once, in bytes
+ */
+size_t mem_peaksize(void);
+
+/**
+ * @brief Returns how often the heap has grown since it was reset.
+ * @return The number of mem_sbrk calls with a positive increment
+ */
+size_t mem_sbrk_calls(void);
+
+/**
+ * @brief Finds where memory that has never held data starts.
+ *
+ * With a dense heap, this is the highest break since mem_init: bytes at or
+ * above it that mem_sbrk, mem_map or mem_remap hand out read as zero, as
+ * fresh pages from the OS would. The sparse emulation and MemorySanitizer
+ * instead treat bytes that were never written as uninitialized, so there
+ * the address is past all of memory.
+ *
+ * @return The lowest address of the fresh memory
+ */
+void *mem_fresh_lo(void);
+
 /**
  * @brief Returns the system page size.
  * @return The page size of the system, in bytes
@@ -112,6 +188,15 @@ void mem_write128(void *addr, __int128_t val);
  */
 void *mem_memcpy(void *dst, const void *src, size_t n);
 
+/**
+ * @brief Emulation of memmove
+ * @param[in] dst
+ * @param[in] src
+ * @param[in] n
+ * @return
+ */
+void *mem_memmove(void *dst, const void *src, size_t n);
+
 /**
  * @brief Emulation of memset
  * @param[in] dst
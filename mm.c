@@ -20,6 +20,7 @@
  */
 
 #include <assert.h>
+#include <errno.h>
 #include <inttypes.h>
 #include <stdbool.h>
 #include <stddef.h>
@@ -28,6 +29,10 @@
 #include <string.h>
 #include <unistd.h>
 
+#ifdef THREAD_SAFE
+#include <pthread.h>
+#endif
+
 #include "memlib.h"
 #include "mm.h"
 
@@ -45,6 +50,15 @@
 
 /* You can change anything from here onward */
 
+#ifdef DRIVER
+/* realloc slides payloads down in place, so memmove needs an alias too */
+#define memmove mem_memmove
+/* the aligned entry points are tested under mm_ names, like malloc */
+#define memalign mm_memalign
+#define posix_memalign mm_posix_memalign
+#define aligned_alloc mm_aligned_alloc
+#endif /* def DRIVER */
+
 /*
  *****************************************************************************
  * If DEBUG is defined (such as when running mdriver-dbg), these macros      *
@@ -86,11 +100,39 @@ static const size_t dsize = 2 * wsize;
 static const size_t min_block_size = dsize;
 
 /**
- * TODO: explain what chunksize is
+ * @brief Bytes at the start of a free block's payload that its list or
+ * tree links may take
+ */
+static const size_t link_size = 4 * wsize;
+
+/**
+ * @brief Smallest amount the heap grows by when no free block fits
  * (Must be divisible by dsize)
  */
 static const size_t chunksize = (1 << 12);
 
+/**
+ * @brief Most times the adaptive growth policy doubles chunksize, which
+ * keeps its largest step at trim_threshold
+ */
+static const size_t grow_doublings = 5;
+
+/**
+ * @brief The adaptive growth policy never adds more than this fraction
+ * (1 / grow_share) of the heap beyond the request, which bounds what an
+ * unused step costs in utilization
+ */
+static const size_t grow_share = 64;
+
+/**
+ * @brief Size of the free block at the top of the heap from which a free
+ * gives memory back to memlib
+ */
+static const size_t trim_threshold = (1 << 17);
+
+/** @brief Free bytes an automatic trim keeps at the top of the heap */
+static const size_t trim_pad = (1 << 16);
+
 /**
  * used to get the last bit of the block size information
  * to see if the block is allocated (1) or not (0)
@@ -109,11 +151,41 @@ static const word_t alloc_mask_prev = 0x2;
  */
 static const word_t mask_min = 0x4;
 
+/**
+ * used to get the fourth last bit of the block size information
+ * to see if the block is a free mini block sitting in list_heads[0] (1).
+ * The header of such a block keeps its size implicit and stores the
+ * payload address of its predecessor in the mini list in the bits above
+ * the flags, which is what lets a mini block be unlinked in O(1)
+ */
+static const word_t mask_mini_free = 0x8;
+
+/**
+ * used to get the flag bits of a header (allocation, previous
+ * allocation and previous mini status)
+ */
+static const word_t flag_mask = 0x7;
+
+/** @brief Position of the owning arena's index in a block header */
+static const unsigned arena_shift = 56;
+
+/**
+ * used to get the index of the arena that owns a block, which every
+ * header written by write_block carries in its top byte
+ */
+static const word_t arena_mask = (word_t)0x7F << 56;
+
+/**
+ * used to get the top bit of the header, which is set on an allocated
+ * block that lives in a mapping of its own rather than in the heap
+ */
+static const word_t mask_mapped = (word_t)1 << 63;
+
 /**
  * used to get the size of the block excluding the last
  * bit to see how large it is
  */
-static const word_t size_mask = ~(word_t)0xF;
+static const word_t size_mask = ~(word_t)0xF & ~((word_t)0xFF << 56);
 
 /** @brief Represents the header and payload of one block in the heap */
 typedef struct block {
@@ -126,6 +198,18 @@ typedef struct block {
             struct block *prev;
         };
 
+        /**
+         * @brief Links of a free block from ordered_class on, which sits
+         * in a red-black tree ordered by size and then address instead of
+         * a list
+         */
+        struct {
+            struct block *left;
+            struct block *right;
+            struct block *parent;
+            bool red;
+        };
+
         /**
          * @brief A pointer to the block payload.
          */
@@ -139,8 +223,277 @@ typedef struct block {
 /** @brief Pointer to first block in the heap: HEAD */
 static block_t *heap_start = NULL;
 
-/** @brief list of heads of the different segmented lists */
-block_t *list_heads[15];
+/**
+ * @brief Smallest request served from a mapping of its own (see
+ * mm_set_map_threshold). Only accessed atomically, as any thread may
+ * change it.
+ */
+static size_t map_threshold = (1 << 17);
+
+/**
+ * @brief How the heap grows when nothing fits (see mm_set_growth). Only
+ * accessed atomically, as any thread may change it.
+ */
+static mm_growth_t growth = MM_GROW_ADAPTIVE;
+
+/**
+ * @brief Smallest free block kept in address order (see
+ * mm_set_ordered_threshold). Only accessed atomically, as any thread may
+ * change it; mm_init turns it into ordered_class.
+ */
+static size_t ordered_threshold = SIZE_MAX;
+
+/** @brief Number of segregated free lists */
+#define NUM_LISTS 64
+
+/**
+ * @brief Largest block size whose bucket holds a single size; buckets
+ * above it are log-linear (see find_size_list)
+ */
+static const size_t linear_class_max = 256;
+
+/** @brief Number of single-size buckets, one per 16 bytes up to 256 */
+static const size_t linear_classes = 16;
+
+/**
+ * @brief Smallest free block that holds the links of a size tree, its
+ * header and its footer
+ */
+static const size_t tree_block_min = 3 * dsize;
+
+/**
+ * @brief First class whose blocks sit in a size tree, in address order
+ * among equal sizes, rather than a LIFO list: linear_classes, unless
+ * ordered_threshold moves it down into the single-size buckets. Set by
+ * mm_init
+ */
+static size_t ordered_class;
+
+/**
+ * @brief Size of a slab, which is also its alignment, so the slab holding
+ * an object starts at the object's page
+ */
+static const size_t slab_size = (1 << 12);
+
+/** @brief Largest request served from a slab */
+static const size_t slab_max = 128;
+
+/** @brief Number of slab classes, one per 16 bytes up to slab_max */
+#define SLAB_CLASSES 8
+
+/** @brief Words in a slab's free bitmap, enough for 256 16-byte objects */
+#define SLAB_MAP_WORDS 4
+
+/**
+ * @brief Number of words in slab_pages. Each bit covers one slab-sized
+ * page, so the map covers the first 128MB of the heap; slabs are never
+ * placed above that.
+ */
+#define SLAB_PAGE_WORDS 512
+
+/**
+ * @brief The header at the start of a slab: a page-aligned allocated
+ * block whose payload is carved into equal objects with no header of
+ * their own
+ */
+typedef struct slab {
+    /** @brief Next slab in the arena's list of slabs with free objects */
+    struct slab *next;
+    /** @brief Previous slab in that list */
+    struct slab *prev;
+    /** @brief The arena the slab was carved from */
+    struct arena *arena;
+    /** @brief Size of every object in the slab */
+    size_t obj_size;
+    /** @brief Number of objects the slab holds */
+    size_t capacity;
+    /** @brief Number of those objects that are free */
+    size_t nfree;
+    /** @brief Bit i is set when object i is free */
+    word_t free_map[SLAB_MAP_WORDS];
+} slab_t;
+
+/** @brief Number of arenas: one per thread group, or one without threads */
+#ifdef THREAD_SAFE
+#define NUM_ARENAS 8
+#else
+#define NUM_ARENAS 1
+#endif
+
+/** @brief Number of fast bins: one per block size up to linear_class_max */
+#define FAST_BINS 16
+
+/**
+ * @brief Once the fast bins of an arena hold more than this many bytes,
+ * a free consolidates them all into the seglists
+ */
+static const size_t fast_limit = 1 << 14;
+
+/** @brief Blocks each arena's dirty log holds between two heap checks */
+#define CHECK_LOG_SIZE 256
+
+/**
+ * @brief Every check_period-th call of mm_checkheap checks the whole heap;
+ * the calls in between only check what changed since the call before
+ */
+static const size_t check_period = 64;
+
+/** @brief Blocks per list find_aligned_fit tries, so memalign stays fast */
+static const size_t aligned_search_max = 35;
+
+/**
+ * @brief An independent heap. Each arena owns its own segregated lists
+ * and its own heap segments, which are runs of memory obtained from
+ * mem_sbrk and bounded by a prologue and an epilogue. An arena grows its
+ * last segment in place while that segment is still at the top of the
+ * heap, and starts a new segment when another arena has grown past it.
+ */
+typedef struct arena {
+    /**
+     * @brief list of heads of the different segmented lists. The classes
+     * from ordered_class on hold the root of a size tree instead
+     */
+    block_t *list_heads[NUM_LISTS];
+
+    /**
+     * @brief Bitmap of the non-empty segregated lists: bit i is set exactly
+     * when list_heads[i] is not NULL, so find_fit can skip empty lists
+     */
+    word_t list_bitmap;
+
+    /**
+     * @brief Smallest block of each size tree, NULL for an empty tree or a
+     * single-size list, so a fit from a class above the request's is
+     * found without walking down the tree
+     */
+    block_t *tree_mins[NUM_LISTS];
+
+    /**
+     * @brief Rover of each list under the NEXT_FIT policy: the block the
+     * class's next search resumes at, or NULL to start from the front
+     */
+    block_t *rovers[NUM_LISTS];
+
+    /** @brief Number of free blocks currently held in each list */
+    size_t list_counts[NUM_LISTS];
+
+    /** @brief Number of find_fit searches satisfied from each list */
+    size_t list_hits[NUM_LISTS];
+
+    /**
+     * @brief Freed blocks of each size up to linear_class_max that have
+     * not been coalesced yet, still marked allocated (see fast_put)
+     */
+    block_t *fast_heads[FAST_BINS];
+
+    /** @brief Total size of the blocks held in the fast bins */
+    size_t fast_bytes;
+
+    /** @brief Epilogue of the arena's newest segment, NULL before it has one */
+    block_t *epilogue;
+
+    /**
+     * @brief The wilderness: the free block right before the epilogue, if
+     * any. It is kept out of the lists, so it is only split when no listed
+     * block fits better (see find_fit)
+     */
+    block_t *wild;
+
+    /**
+     * @brief Times the arena has grown since the heap last shrank, which
+     * sets the adaptive growth step (see grow_size)
+     */
+    size_t grow_streak;
+
+    /**
+     * @brief From here to the top of the newest segment, no byte has held
+     * data since memlib handed it out fresh, so all of them are zero except
+     * the header, links and footer of the free block over them
+     */
+    char *fresh;
+
+    /** @brief Slabs with at least one free object, one list per class */
+    slab_t *slabs[SLAB_CLASSES];
+
+    /**
+     * @brief Estimate of the live requests of each slab class held in
+     * ordinary blocks, which decides when a class is worth a slab
+     */
+    size_t slab_demand[SLAB_CLASSES];
+
+    /**
+     * @brief Dirty log of the heap checker: blocks written since the last
+     * check, once mm_checkheap has run. Some may since have been merged
+     * into a block written after them
+     */
+    block_t *check_log[CHECK_LOG_SIZE];
+
+    /** @brief Number of blocks logged, which may exceed CHECK_LOG_SIZE */
+    size_t check_logged;
+
+    /** @brief Bitmap of the lists changed since the last heap check */
+    word_t check_lists;
+
+#ifdef THREAD_SAFE
+    /** @brief Lock protecting the arena's lists and segments */
+    pthread_mutex_t lock;
+
+    /** @brief Number of live threads allocating from this arena */
+    size_t threads;
+#endif
+} arena_t;
+
+/** @brief The arenas; arenas[0] also holds the first segment of the heap */
+static arena_t arenas[NUM_ARENAS];
+
+/**
+ * @brief Bitmap of the heap pages that start a live slab, which tells a
+ * slab object apart from a block payload exactly. A bit only changes
+ * while no object of its page is allocated, so it can be read without
+ * holding any lock.
+ */
+static word_t slab_pages[SLAB_PAGE_WORDS];
+
+/** @brief Start of the heap, the origin of slab_pages */
+static uintptr_t slab_base = 0;
+
+/**
+ * @brief Whether the arenas keep their dirty logs, which they do from the
+ * first call of mm_checkheap after mm_init on
+ */
+static bool check_armed = false;
+
+/** @brief Calls of mm_checkheap since mm_init */
+static size_t check_calls = 0;
+
+#ifdef MM_STATS
+/** @brief Whether the counters reported by mm_stats are kept */
+static const bool stats_enabled = true;
+#else
+static const bool stats_enabled = false;
+#endif
+
+#ifdef NEXT_FIT
+/** @brief Whether find_fit resumes each class's search at its rover */
+static const bool next_fit = true;
+#else
+static const bool next_fit = false;
+#endif
+
+/**
+ * @brief Event counters reported by mm_stats, since mm_init. They are
+ * only updated when stats_enabled, so a build without MM_STATS compiles
+ * the updates out.
+ */
+static mm_stats_t stats;
+
+#ifdef THREAD_SAFE
+/**
+ * @brief Lock protecting memlib, which every arena grows through, and the
+ * arena thread counts
+ */
+static pthread_mutex_t heap_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
 
 /*
  *****************************************************************************
@@ -172,6 +525,38 @@ static size_t max(size_t x, size_t y) {
     return (x > y) ? x : y;
 }
 
+/**
+ * @brief Adds n to one of the counters in stats, if they are kept. A
+ * counter may be bumped from several arenas at once, so the thread-safe
+ * build adds atomically.
+ * @param[in] counter a field of stats
+ * @param[in] n the amount to add, which wraps around to subtract
+ */
+static void stat_add(size_t *counter, size_t n) {
+    if (stats_enabled) {
+#ifdef THREAD_SAFE
+        __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+#else
+        *counter += n;
+#endif
+    }
+}
+
+/**
+ * @brief Records a fit search in the histogram of search lengths.
+ * @param[in] visited the number of free blocks the search looked at
+ */
+static void stat_search(size_t visited) {
+    if (stats_enabled) {
+        size_t bucket = 0;
+        while (visited != 0 && bucket < MM_SEARCH_BUCKETS - 1) {
+            visited >>= 1;
+            bucket++;
+        }
+        stat_add(&stats.searches[bucket], 1);
+    }
+}
+
 /**
  * @brief Rounds `size` up to next multiple of n
  * @param[in] size
@@ -212,43 +597,146 @@ static word_t pack(size_t size, bool alloc, bool prev_alloc, bool min_status) {
 
 /**
  * @brief Finds the bucket list according to given size
- * There are 15 buckets that each free block can be stored in
+ *
+ * The 64 buckets form a log-linear size-class table. Sizes up to
+ * linear_class_max get one bucket per 16-byte step, so those buckets only
+ * ever hold blocks of a single size. Above that, every power of two is
+ * split into 4 equal sub-classes, which is read straight off the bits
+ * below the most significant one. Everything past the last sub-class goes
+ * into the final bucket.
+ *
  * @param[in] size The size of the block being represented
  * @return The index corresponding to the bucket in the list
  */
 static size_t find_size_list(size_t size) {
-    if (size <= 16) {
-        return 0;
-    } else if (size <= 32) {
-        return 1;
-    } else if (size < 49) {
-        return 2;
-    } else if (size < 65) {
-        return 3;
-    } else if (size < 90) {
-        return 4;
-    } else if (size < 113) {
-        return 5;
-    } else if (size < 129) {
-        return 6;
-    } else if (size < 145) {
-        return 7;
-    } else if (size < 161) {
-        return 8;
-    } else if (size < 177) {
-        return 9;
-    } else if (size < 257) {
-        return 10;
-    } else if (size < 513) {
-        return 11;
-    } else if (size < 900) {
-        return 12;
-    } else if (size < 5000) {
-        return 13;
+    if (size <= linear_class_max) {
+        return (size >> 4) - 1;
     }
 
-    else {
-        return 14;
+    word_t v = (word_t)size - 1;
+    size_t log = 63 - (size_t)__builtin_clzll(v);
+    size_t sub = (size_t)(v >> (log - 2)) & 3;
+    size_t index = linear_classes + ((log - 8) << 2) + sub;
+
+    return index < NUM_LISTS ? index : NUM_LISTS - 1;
+}
+
+/**
+ * @brief Returns the value an arena stores in the top byte of the headers
+ * it writes.
+ * @param[in] arena
+ * @return The arena's index, shifted into place
+ */
+static word_t arena_tag(arena_t *arena) {
+    return (word_t)(arena - arenas) << arena_shift;
+}
+
+/**
+ * @brief Reads a block's header with a single atomic load. The owner of an
+ * allocated block reads its header without taking the arena lock, while
+ * the thread holding the lock may be rewriting the flags the header keeps
+ * about the block before it (see write_block).
+ * @param[in] block A block
+ * @return The block's header
+ */
+static word_t read_header(block_t *block) {
+    return __atomic_load_n(&block->header, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Returns the arena that owns an allocated block.
+ * @param[in] block An allocated block
+ * @return The arena recorded in the block's header
+ */
+static arena_t *arena_of(block_t *block) {
+    return &arenas[(read_header(block) & arena_mask) >> arena_shift];
+}
+
+#ifdef THREAD_SAFE
+
+/**
+ * @brief Acquires the heap lock, which serializes calls into memlib.
+ */
+static void lock_heap(void) {
+    pthread_mutex_lock(&heap_mutex);
+}
+
+/**
+ * @brief Releases the heap lock.
+ */
+static void unlock_heap(void) {
+    pthread_mutex_unlock(&heap_mutex);
+}
+
+/**
+ * @brief Acquires an arena's lock. It is always taken before the heap
+ * lock, never while holding it.
+ * @param[in] arena
+ */
+static void lock_arena(arena_t *arena) {
+    pthread_mutex_lock(&arena->lock);
+}
+
+/**
+ * @brief Releases an arena's lock.
+ * @param[in] arena
+ */
+static void unlock_arena(arena_t *arena) {
+    pthread_mutex_unlock(&arena->lock);
+}
+
+#else
+
+/**
+ * @brief Acquires the heap lock (nothing to do without THREAD_SAFE).
+ */
+static void lock_heap(void) {
+}
+
+/**
+ * @brief Releases the heap lock (nothing to do without THREAD_SAFE).
+ */
+static void unlock_heap(void) {
+}
+
+/**
+ * @brief Acquires an arena's lock (nothing to do without THREAD_SAFE).
+ * @param[in] arena
+ */
+static void lock_arena(arena_t *arena) {
+}
+
+/**
+ * @brief Releases an arena's lock (nothing to do without THREAD_SAFE).
+ * @param[in] arena
+ */
+static void unlock_arena(arena_t *arena) {
+}
+
+#endif /* def THREAD_SAFE */
+
+/**
+ * @brief Records that a block was added to a segregated list.
+ * @param[in] arena The arena owning the list
+ * @param[in] index The list the block was added to
+ */
+static void list_added(arena_t *arena, size_t index) {
+    arena->list_bitmap |= (word_t)1 << index;
+    arena->check_lists |= (word_t)1 << index;
+    arena->list_counts[index]++;
+}
+
+/**
+ * @brief Records that a block was taken out of a segregated list, clearing
+ * the list's bit in list_bitmap once it becomes empty.
+ * @param[in] arena The arena owning the list
+ * @param[in] index The list the block was removed from
+ */
+static void list_removed(arena_t *arena, size_t index) {
+    arena->check_lists |= (word_t)1 << index;
+    arena->list_counts[index]--;
+    if (arena->list_heads[index] == NULL) {
+        arena->list_bitmap &= ~((word_t)1 << index);
     }
 }
 
@@ -262,6 +750,9 @@ static size_t find_size_list(size_t size) {
  * @return The size of the block represented by the word
  */
 static size_t extract_size(word_t word) {
+    if (word & mask_mini_free) {
+        return min_block_size;
+    }
     return (word & size_mask);
 }
 
@@ -336,112 +827,496 @@ static block_t *footer_to_header(word_t *footer) {
 }
 
 /**
- * @brief Given a block that is mini, inserted into seglist (bucket 0).
- * @param[in] block the block needed to be inserted
- * @return A pointer to the start of the block inserted
- * @pre block is not null.
+ * @brief Returns the block before a free mini block in the mini list.
+ *
+ * The link lives in the block's header as the predecessor's payload
+ * address, which is 16-byte aligned and so leaves the flag bits free.
+ *
+ * @param[in] block a free mini block inside list_heads[0]
+ * @return The previous block in the mini list, or NULL for the head
  */
-static block_t *min_block_insertion(block_t *block) {
-    block->next = list_heads[0];
-    list_heads[0] = block;
-    return block;
+static block_t *get_mini_prev(block_t *block) {
+    word_t link = block->header & ~(flag_mask | mask_mini_free);
+    if (link == 0) {
+        return NULL;
+    }
+    return (block_t *)((char *)(uintptr_t)link - offsetof(block_t, payload));
 }
 
 /**
- * @brief Given a block, insert into seglist.
- * @param[in] block the block needed to be inserted
- * @return A pointer to the start of the block insert
- * @pre block is not null.
+ * @brief Sets the block before a free mini block in the mini list, marking
+ * the header as a free mini block while keeping its flag bits.
+ * @param[out] block a free mini block
+ * @param[in] prev the previous block in the mini list, or NULL
  */
-static block_t *block_insertion(block_t *block) {
-    // if it is mini block, work with its singlylist link differentl
-    if (get_size(block) <= min_block_size) {
-        return min_block_insertion(block);
-    }
-    size_t index = find_size_list(get_size(block));
-
-    // LIFO add block to start of list at head
-    block->next = list_heads[index];
-    block->prev = NULL;
-    if (list_heads[index] != NULL) {
-        list_heads[index]->prev = block;
+static void set_mini_prev(block_t *block, block_t *prev) {
+    word_t link = 0;
+    if (prev != NULL) {
+        link = (word_t)(uintptr_t)prev->payload;
     }
-    list_heads[index] = block;
+    block->header = link | mask_mini_free | (block->header & flag_mask);
+}
 
-    return block;
+/**
+ * @brief Orders two free blocks by size, breaking ties by address.
+ * @param[in] a
+ * @param[in] b
+ * @return true if a comes before b in the size tree
+ */
+static bool tree_before(block_t *a, block_t *b) {
+    size_t a_size = get_size(a);
+    size_t b_size = get_size(b);
+    return a_size < b_size || (a_size == b_size && a < b);
 }
 
 /**
- * @brief Given a block, checks if block is inside seglists.
- * @param[in] block the block needed to be checked
- * @return false is block is not in seglist, true otherwise
- * @pre block is not null.
+ * @brief Returns whether a size tree node is red, NULL leaves being black.
+ * @param[in] node
+ * @return true if node is a red node
  */
-static bool inside_list(block_t *block) {
+static bool tree_red(block_t *node) {
+    return node != NULL && node->red;
+}
 
-    size_t index = find_size_list(get_size(block));
+/**
+ * @brief Puts `child` in place of `node` under node's parent.
+ * @param[in] root the tree's root pointer
+ * @param[in] node a node of the tree
+ * @param[in] child the subtree taking its place, or NULL
+ */
+static void tree_replace(block_t **root, block_t *node, block_t *child) {
+    block_t *parent = node->parent;
+    if (parent == NULL) {
+        *root = child;
+    } else if (parent->left == node) {
+        parent->left = child;
+    } else {
+        parent->right = child;
+    }
+    if (child != NULL) {
+        child->parent = parent;
+    }
+}
 
-    for (block_t *curr = list_heads[index]; curr != NULL; curr = curr->next) {
-        if (block == curr)
-            return true;
+/**
+ * @brief Rotates a node down to the left, its right child taking its place.
+ * @param[in] root the tree's root pointer
+ * @param[in] node a node with a right child
+ */
+static void tree_rotate_left(block_t **root, block_t *node) {
+    block_t *right = node->right;
+    node->right = right->left;
+    if (right->left != NULL) {
+        right->left->parent = node;
     }
-    return false;
+    tree_replace(root, node, right);
+    right->left = node;
+    node->parent = right;
 }
 
 /**
- * @brief Given a mini block, remove from seglist.
- * @param[in] block the block needed to be removed
- * @return A pointer to the start of the block removed
- * @pre block is not null.
+ * @brief Rotates a node down to the right, its left child taking its place.
+ * @param[in] root the tree's root pointer
+ * @param[in] node a node with a left child
  */
-static block_t *min_block_removal(block_t *block) {
-    dbg_assert(inside_list(block));
+static void tree_rotate_right(block_t **root, block_t *node) {
+    block_t *left = node->left;
+    node->left = left->right;
+    if (left->right != NULL) {
+        left->right->parent = node;
+    }
+    tree_replace(root, node, left);
+    left->right = node;
+    node->parent = left;
+}
 
-    // one element
-    if (block == list_heads[0] && list_heads[0]->next == NULL) {
-        block->next = NULL;
-        list_heads[0] = NULL;
-        return block;
+/**
+ * @brief
+ *
+ * Inserts a free block into a size tree as a red leaf, then restores the
+ * red-black rules on the way up by recolouring and at most two rotations.
+ *
+ * @param[in] root the tree's root pointer
+ * @param[in,out] min the tree's smallest block, updated if block is smaller
+ * @param[in] block the block to insert, not yet in any tree
+ */
+static void tree_insert(block_t **root, block_t **min, block_t *block) {
+    block_t *parent = NULL;
+    bool smallest = true; // only went left on the way down
+    for (block_t *curr = *root; curr != NULL;) {
+        parent = curr;
+        if (tree_before(block, curr)) {
+            curr = curr->left;
+        } else {
+            curr = curr->right;
+            smallest = false;
+        }
     }
-    // first element
-    else if (block == list_heads[0]) {
-        list_heads[0] = block->next;
-        block->next = NULL;
-        return block;
+    if (smallest) {
+        *min = block;
     }
-    // middle element
-    else {
-        // loop through list to find element and set previous next to current
-        // next to take out of list
-        block_t *prev = NULL;
-        for (block_t *curr = list_heads[0]; curr != NULL; curr = curr->next) {
-            if (curr == block) {
-                prev->next = curr->next;
-                block->next = NULL;
-                return block;
+    block->left = NULL;
+    block->right = NULL;
+    block->parent = parent;
+    block->red = true;
+    if (parent == NULL) {
+        *root = block;
+    } else if (tree_before(block, parent)) {
+        parent->left = block;
+    } else {
+        parent->right = block;
+    }
+
+    block_t *node = block;
+    while (tree_red(node->parent)) {
+        parent = node->parent;
+        block_t *grand = parent->parent;
+        if (parent == grand->left) {
+            block_t *uncle = grand->right;
+            if (tree_red(uncle)) {
+                parent->red = false;
+                uncle->red = false;
+                grand->red = true;
+                node = grand;
+                continue;
             }
-            prev = curr;
+            if (node == parent->right) {
+                tree_rotate_left(root, parent);
+                parent = node;
+            }
+            parent->red = false;
+            grand->red = true;
+            tree_rotate_right(root, grand);
+            break;
+        } else {
+            block_t *uncle = grand->left;
+            if (tree_red(uncle)) {
+                parent->red = false;
+                uncle->red = false;
+                grand->red = true;
+                node = grand;
+                continue;
+            }
+            if (node == parent->left) {
+                tree_rotate_right(root, parent);
+                parent = node;
+            }
+            parent->red = false;
+            grand->red = true;
+            tree_rotate_left(root, grand);
+            break;
         }
-        return NULL;
     }
+    (*root)->red = false;
+}
+
+/**
+ * @brief Returns the block after a node in its tree's (size, address)
+ * order: the leftmost block on its right, or else the first ancestor it
+ * is on the left of.
+ * @param[in] node a block in a size tree
+ * @return the next block, or NULL if node is the largest
+ */
+static block_t *tree_next(block_t *node) {
+    if (node->right != NULL) {
+        node = node->right;
+        while (node->left != NULL) {
+            node = node->left;
+        }
+        return node;
+    }
+    while (node->parent != NULL && node == node->parent->right) {
+        node = node->parent;
+    }
+    return node->parent;
+}
+
+/**
+ * @brief
+ *
+ * Takes a free block out of a size tree. The parent links make this
+ * independent of the block's key: a block with two children swaps places
+ * with its in-order successor first. If a black node left the tree, the
+ * missing black is pushed up or absorbed with at most three rotations.
+ *
+ * @param[in] root the tree's root pointer
+ * @param[in,out] min the tree's smallest block, updated if it is block
+ * @param[in] block a block in the tree
+ */
+static void tree_delete(block_t **root, block_t **min, block_t *block) {
+    block_t *child;
+    block_t *parent;
+    bool removed_red;
+
+    if (block == *min) {
+        *min = tree_next(block);
+    }
+
+    if (block->left == NULL || block->right == NULL) {
+        child = block->left != NULL ? block->left : block->right;
+        parent = block->parent;
+        removed_red = block->red;
+        tree_replace(root, block, child);
+    } else {
+        block_t *heir = block->right;
+        while (heir->left != NULL) {
+            heir = heir->left;
+        }
+        child = heir->right;
+        removed_red = heir->red;
+        if (heir->parent == block) {
+            parent = heir;
+        } else {
+            parent = heir->parent;
+            tree_replace(root, heir, child);
+            heir->right = block->right;
+            heir->right->parent = heir;
+        }
+        tree_replace(root, block, heir);
+        heir->left = block->left;
+        heir->left->parent = heir;
+        heir->red = block->red;
+    }
+    if (removed_red) {
+        return;
+    }
+
+    // child carries an extra black until it is red or the root
+    while (child != *root && !tree_red(child)) {
+        if (child == parent->left) {
+            block_t *sibling = parent->right;
+            if (sibling->red) {
+                sibling->red = false;
+                parent->red = true;
+                tree_rotate_left(root, parent);
+                sibling = parent->right;
+            }
+            if (!tree_red(sibling->left) && !tree_red(sibling->right)) {
+                sibling->red = true;
+                child = parent;
+                parent = child->parent;
+                continue;
+            }
+            if (!tree_red(sibling->right)) {
+                sibling->left->red = false;
+                sibling->red = true;
+                tree_rotate_right(root, sibling);
+                sibling = parent->right;
+            }
+            sibling->red = parent->red;
+            parent->red = false;
+            sibling->right->red = false;
+            tree_rotate_left(root, parent);
+        } else {
+            block_t *sibling = parent->left;
+            if (sibling->red) {
+                sibling->red = false;
+                parent->red = true;
+                tree_rotate_right(root, parent);
+                sibling = parent->left;
+            }
+            if (!tree_red(sibling->left) && !tree_red(sibling->right)) {
+                sibling->red = true;
+                child = parent;
+                parent = child->parent;
+                continue;
+            }
+            if (!tree_red(sibling->left)) {
+                sibling->right->red = false;
+                sibling->red = true;
+                tree_rotate_left(root, sibling);
+                sibling = parent->left;
+            }
+            sibling->red = parent->red;
+            parent->red = false;
+            sibling->left->red = false;
+            tree_rotate_right(root, parent);
+        }
+        child = *root;
+    }
+    if (child != NULL) {
+        child->red = false;
+    }
+}
+
+/**
+ * @brief Finds the smallest block of at least `asize` bytes in a size
+ * tree, taking the lowest address among equal sizes.
+ * @param[in] root the root of the tree
+ * @param[in] asize the size wanted
+ * @param[in,out] visited incremented for every node looked at
+ * @return the best fit, or NULL if no block is large enough
+ */
+static block_t *tree_best_fit(block_t *root, size_t asize, size_t *visited) {
+    block_t *best = NULL;
+    while (root != NULL) {
+        (*visited)++;
+        if (get_size(root) >= asize) {
+            best = root;
+            root = root->left;
+        } else {
+            root = root->right;
+        }
+    }
+    return best;
+}
+
+/**
+ * @brief Given a block that is mini, inserted into seglist (bucket 0).
+ * @param[in] arena the arena the block belongs to
+ * @param[in] block the block needed to be inserted
+ * @return A pointer to the start of the block inserted
+ * @pre block is not null.
+ */
+static block_t *min_block_insertion(arena_t *arena, block_t *block) {
+    block->next = arena->list_heads[0];
+    set_mini_prev(block, NULL);
+    if (arena->list_heads[0] != NULL) {
+        set_mini_prev(arena->list_heads[0], block);
+    }
+    arena->list_heads[0] = block;
+    list_added(arena, 0);
+    return block;
+}
+
+/**
+ * @brief Given a block, insert into seglist.
+ * @param[in] arena the arena the block belongs to
+ * @param[in] block the block needed to be inserted
+ * @return A pointer to the start of the block insert
+ * @pre block is not null.
+ */
+static block_t *block_insertion(arena_t *arena, block_t *block) {
+    // the block at the top of the newest segment is the wilderness
+    if ((block_t *)((char *)block + get_size(block)) == arena->epilogue) {
+        arena->wild = block;
+        return block;
+    }
+
+    // if it is mini block, work with its singlylist link differentl
+    if (get_size(block) <= min_block_size) {
+        return min_block_insertion(arena, block);
+    }
+    size_t index = find_size_list(get_size(block));
+
+    // blocks from ordered_class on are kept in their class's tree
+    if (index >= ordered_class) {
+        tree_insert(&arena->list_heads[index], &arena->tree_mins[index],
+                    block);
+        list_added(arena, index);
+        return block;
+    }
+
+    // LIFO add block to start of list at head
+    block->next = arena->list_heads[index];
+    block->prev = NULL;
+    if (arena->list_heads[index] != NULL) {
+        arena->list_heads[index]->prev = block;
+    }
+    arena->list_heads[index] = block;
+    list_added(arena, index);
+
+    return block;
+}
+
+/**
+ * @brief Given a block, checks if block is inside seglists.
+ * @param[in] arena the arena whose lists are searched
+ * @param[in] block the block needed to be checked
+ * @return false is block is not in seglist, true otherwise
+ * @pre block is not null.
+ */
+static bool inside_list(arena_t *arena, block_t *block) {
+
+    size_t index = find_size_list(get_size(block));
+
+    for (block_t *curr = arena->list_heads[index]; curr != NULL;
+         curr = curr->next) {
+        if (block == curr)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Moves a list's rover off a block that is leaving the list, to
+ * the block after it, so the rover only ever points into its list.
+ * @param[in] arena the arena the block belongs to
+ * @param[in] index the block's list
+ * @param[in] block the block being removed, still linked
+ */
+static void rover_leave(arena_t *arena, size_t index, block_t *block) {
+    if (next_fit && arena->rovers[index] == block) {
+        arena->rovers[index] =
+            index >= ordered_class ? tree_next(block) : block->next;
+    }
+}
+
+/**
+ * @brief Given a mini block, remove from seglist.
+ *
+ * The predecessor is read from the block's header, so unlinking takes
+ * constant time. The header goes back to an ordinary free header with an
+ * explicit size once the block is out of the list.
+ *
+ * @param[in] arena the arena the block belongs to
+ * @param[in] block the block needed to be removed
+ * @return A pointer to the start of the block removed
+ * @pre block is not null.
+ */
+static block_t *min_block_removal(arena_t *arena, block_t *block) {
+    dbg_assert(inside_list(arena, block));
+    rover_leave(arena, 0, block);
+
+    block_t *prev = get_mini_prev(block);
+    block_t *next = block->next;
+
+    if (prev == NULL) {
+        arena->list_heads[0] = next;
+    } else {
+        prev->next = next;
+    }
+    if (next != NULL) {
+        set_mini_prev(next, prev);
+    }
+
+    block->next = NULL;
+    block->header =
+        min_block_size | arena_tag(arena) | (block->header & flag_mask);
+    list_removed(arena, 0);
+    return block;
 }
 
 /**
  * @brief Given a block, remove from seglist.
+ * @param[in] arena the arena the block belongs to
  * @param[in] block the block needed to be removed
  * @return A pointer to the start of the block removed
  * @pre block is not null.
  */
-static block_t *block_removal(block_t *block) {
+static block_t *block_removal(arena_t *arena, block_t *block) {
+    if (block == arena->wild) {
+        arena->wild = NULL;
+        return block;
+    }
+
     // if it is mini block, work with its singlylist link differently
     if (get_size(block) <= min_block_size) {
-        return min_block_removal(block);
+        return min_block_removal(arena, block);
     }
 
+    block_t **list_heads = arena->list_heads;
     size_t index = find_size_list(get_size(block));
+    rover_leave(arena, index, block);
+
+    if (index >= ordered_class) {
+        tree_delete(&list_heads[index], &arena->tree_mins[index], block);
+        list_removed(arena, index);
+        return block;
+    }
 
     dbg_assert(list_heads[index] != NULL);
-    dbg_assert(inside_list(block));
+    dbg_assert(inside_list(arena, block));
 
     // one element
     if (block == list_heads[index] && list_heads[index]->next == NULL) {
@@ -473,6 +1348,7 @@ static block_t *block_removal(block_t *block) {
         block->next = NULL;
         block->prev = NULL;
     }
+    list_removed(arena, index);
     return block;
 }
 
@@ -497,6 +1373,15 @@ static bool get_alloc(block_t *block) {
     return extract_alloc(block->header);
 }
 
+/**
+ * @brief Returns whether an allocated block lives in a mapping of its own.
+ * @param[in] block An allocated block
+ * @return True if the block was mapped by map_malloc
+ */
+static bool get_mapped(block_t *block) {
+    return (block->header & mask_mapped) != 0;
+}
+
 /**
  * @brief Returns the previous allocation status of a given header value.
  *
@@ -544,13 +1429,15 @@ static bool get_min_status(block_t *block) {
 /**
  * @brief Writes an epilogue header at the given address.
  *
- * The epilogue header has size 0, and is marked as allocated.
+ * The epilogue header has size 0, and is marked as allocated. Every heap
+ * segment ends in one, so only the newest segment's epilogue sits at the
+ * top of the heap.
  *
  * @param[out] block The location to write the epilogue header
  */
 static void write_epilogue(block_t *block, bool prev_alloc) {
     dbg_requires(block != NULL);
-    dbg_requires((char *)block == (char *)mem_heap_hi() - 7);
+    dbg_requires((char *)block <= (char *)mem_heap_hi() - 7);
     block->header = pack(0, true, prev_alloc, false);
 }
 
@@ -594,32 +1481,43 @@ static block_t *find_next(block_t *block) {
  *
  * This function writes both a header and footer, where the location of the
  * footer is computed in relation to the header. Also writes the header of the
- * next block with the information given from the current block.
+ * next block with the information given from the current block. The header
+ * also records the arena the block belongs to.
  *
  * TODO: Are there any preconditions or postconditions?
  *
+ * @param[in] arena The arena owning the block
  * @param[out] block The location to begin writing the block header
  * @param[in] size The size of the new block
  * @param[in] alloc The allocation status of the new block
  * @pre block is not null
  * @pre size > 0
  */
-static void write_block(block_t *block, size_t size, bool alloc,
-                        bool alloc_prev) {
+static void write_block(arena_t *arena, block_t *block, size_t size,
+                        bool alloc, bool alloc_prev) {
     dbg_requires(block != NULL);
     dbg_requires(size > 0);
 
-    block->header = pack(size, alloc, alloc_prev, get_min_status(block));
+    block->header = pack(size, alloc, alloc_prev, get_min_status(block)) |
+                    arena_tag(arena);
+    if (__atomic_load_n(&check_armed, __ATOMIC_RELAXED)) {
+        size_t logged = arena->check_logged++;
+        if (logged < CHECK_LOG_SIZE) {
+            arena->check_log[logged] = block;
+        }
+    }
     if (!alloc && size > min_block_size) {
         word_t *footerp = header_to_footer(block);
         *footerp = pack(size, alloc, alloc_prev, get_min_status(block));
     }
+    // only touch the next block's flags: a free mini block keeps its list
+    // link in the rest of its header. An allocated next block may have its
+    // header read by its owner at the same time (see read_header)
     block_t *next = find_next(block);
-    if (size <= min_block_size) {
-        next->header = pack(get_size(next), get_alloc(next), alloc, true);
-    } else {
-        next->header = pack(get_size(next), get_alloc(next), alloc, false);
-    }
+    word_t flags = pack(0, false, alloc, size <= min_block_size);
+    __atomic_store_n(&next->header,
+                     (next->header & ~(alloc_mask_prev | mask_min)) | flags,
+                     __ATOMIC_RELAXED);
 }
 
 /**
@@ -677,10 +1575,11 @@ static block_t *find_prev(block_t *block) {
  * it together with other freed blocks. There are 4 general cases
  * that the heap can have and each are addressed below
  *
+ * @param[in] arena the arena the block belongs to
  * @param[in] block in the heap that is freed
  * @return final block that is maximally coalesced
  */
-static block_t *coalesce_block(block_t *block) {
+static block_t *coalesce_block(arena_t *arena, block_t *block) {
 
     // block_t *previous = find_prev(block);
     // dbg_assert(block != NULL);
@@ -697,75 +1596,216 @@ static block_t *coalesce_block(block_t *block) {
     // Case 2: Block freed is sandwiched between one allocated and one freed
     // block
     else if (get_alloc_prev(block) && !get_alloc(next)) {
-        block_removal(next);
-        write_block(block, size + get_size(next), false, true);
+        stat_add(&stats.coalesces, 1);
+        block_removal(arena, next);
+        write_block(arena, block, size + get_size(next), false, true);
 
         return block;
     }
     // Case 3: Block freed is sandwiched between one freed block and one
     // allocated
     else if (!get_alloc_prev(block) && get_alloc(next)) {
+        stat_add(&stats.coalesces, 1);
         block_t *previous = find_prev(block);
-        block_removal(previous);
-        write_block(previous, size + get_size(previous), false,
+        block_removal(arena, previous);
+        write_block(arena, previous, size + get_size(previous), false,
                     get_alloc_prev(previous));
 
         return previous;
     }
     // Case 4: Block freed is sandwiched between two freed blocks
     else {
+        stat_add(&stats.coalesces, 2);
         block_t *previous = find_prev(block);
-        block_removal(previous);
-        block_removal(next);
+        block_removal(arena, previous);
+        block_removal(arena, next);
 
-        write_block(previous, get_size(previous) + size + get_size(next), false,
-                    get_alloc_prev(previous));
+        write_block(arena, previous, get_size(previous) + size + get_size(next),
+                    false, get_alloc_prev(previous));
 
         return previous;
     }
     return block;
 }
 
+/**
+ * @brief
+ *
+ * Parks a freed block of at most linear_class_max bytes in its arena's
+ * fast bin for its size. The block stays marked allocated, linked through
+ * its first payload word, so nothing coalesces with it: a request of the
+ * same size takes it back without splitting anything.
+ *
+ * @param[in] arena the arena the block belongs to
+ * @param[in] block allocated block being freed
+ */
+static void fast_put(arena_t *arena, block_t *block) {
+    size_t index = (get_size(block) - 1) / dsize;
+    block->next = arena->fast_heads[index];
+    arena->fast_heads[index] = block;
+    arena->fast_bytes += get_size(block);
+}
+
+/**
+ * @brief Takes a block of exactly asize bytes from the arena's fast bins.
+ * @param[in] arena the arena to allocate from
+ * @param[in] asize size of the block, at most linear_class_max
+ * @return an allocated block, or NULL if the bin is empty
+ */
+static block_t *fast_get(arena_t *arena, size_t asize) {
+    size_t index = (asize - 1) / dsize;
+    block_t *block = arena->fast_heads[index];
+    if (block != NULL) {
+        arena->fast_heads[index] = block->next;
+        arena->fast_bytes -= asize;
+    }
+    return block;
+}
+
+/**
+ * @brief
+ *
+ * Empties the arena's fast bins, freeing every block in them for real:
+ * each is coalesced with its free neighbours and inserted into the
+ * seglists. Called when a fit search misses and the bins might hold the
+ * memory it needs, and when the bins grow past fast_limit.
+ *
+ * @param[in] arena the arena to consolidate
+ * @return true if any block was released
+ */
+static bool fast_consolidate(arena_t *arena) {
+    if (arena->fast_bytes == 0) {
+        return false;
+    }
+    for (size_t i = 0; i < FAST_BINS; i++) {
+        block_t *block = arena->fast_heads[i];
+        arena->fast_heads[i] = NULL;
+        while (block != NULL) {
+            block_t *next = block->next;
+            write_block(arena, block, get_size(block), false,
+                        get_alloc_prev(block));
+            block_insertion(arena, coalesce_block(arena, block));
+            block = next;
+        }
+    }
+    arena->fast_bytes = 0;
+    return true;
+}
+
+/**
+ * @brief
+ *
+ * Returns how far to grow the heap for a request of asize bytes that no
+ * free block fits. The fixed policy always grows by chunksize. The
+ * adaptive policy doubles the step each time the arena has to grow again,
+ * up to grow_doublings times, so a steadily growing heap calls sbrk far
+ * less often; the step is kept to a small share of the heap, so a small
+ * heap does not pay in utilization for memory it may never use, and the
+ * streak restarts whenever the heap is trimmed.
+ *
+ * @param[in] arena the arena that is growing
+ * @param[in] asize size of the block the growth must fit
+ * @return the number of bytes to pass to extend_heap
+ */
+static size_t grow_size(arena_t *arena, size_t asize) {
+    size_t step = chunksize;
+    if (__atomic_load_n(&growth, __ATOMIC_RELAXED) == MM_GROW_ADAPTIVE) {
+        size_t doublings = arena->grow_streak < grow_doublings
+                               ? arena->grow_streak
+                               : grow_doublings;
+        step = chunksize << doublings;
+        lock_heap();
+        size_t share = mem_heapsize() / grow_share;
+        unlock_heap();
+        if (step > share) {
+            step = max(share, chunksize);
+        }
+        arena->grow_streak++;
+    }
+    return max(asize, step);
+}
+
 /**
  * @brief
  *
  * Extends the heap by the amount of space necessary to insert and allocate a
  * new block requires size to be greater than the min block size
  *
+ * While the arena's newest segment still ends at the top of the heap, the
+ * new block takes the place of its epilogue, exactly as in a single heap.
+ * Otherwise another arena has grown the heap since, so the memory becomes
+ * a new segment of its own: a prologue followed by the new block and an
+ * epilogue.
+ *
+ * @param[in] arena the arena that is growing
  * @param[in] size amount of space that needs to be allocated on the heap
  * @return block that is extended off of the heap
  */
-static block_t *extend_heap(size_t size) {
+static block_t *extend_heap(arena_t *arena, size_t size) {
     void *bp;
+    block_t *block;
+    stat_add(&stats.extends, 1);
     // Allocate an even number of words to maintain alignment
     size = round_up(size, min_block_size);
-    if ((bp = mem_sbrk((intptr_t)size)) == (void *)-1) {
 
-        return NULL;
+    // memlib is shared by every arena, so check the top and grow under
+    // the heap lock
+    lock_heap();
+    char *fresh = mem_fresh_lo();
+    bool at_top = arena->epilogue != NULL &&
+                  (char *)arena->epilogue == (char *)mem_heap_hi() - 7;
+    if (at_top) {
+        bp = mem_sbrk((intptr_t)size);
+    } else {
+        bp = mem_sbrk((intptr_t)(size + dsize));
     }
+    unlock_heap();
 
-    /*
-     * TODO: delete or replace this comment once you've thought about it.
-     * Think about what bp represents. Why do we write the new block
-     * starting one word BEFORE bp, but with the same size that we
-     * originally requested?
-     */
+    if (bp == (void *)-1) {
+        return NULL;
+    }
 
-    // Initialize free block header/footer
-    block_t *block = payload_to_header(bp);
+    if (at_top) {
+        // The new block starts one word before bp, over the old epilogue
+        block = payload_to_header(bp);
+    } else {
+        // The prologue takes the first word; the new block header, written
+        // over a provisional epilogue, the second
+        *(word_t *)bp = pack(0, true, false, false) | arena_tag(arena);
+        block = (block_t *)((char *)bp + wsize);
+        block->header = pack(0, true, true, false);
+    }
 
-    write_block(block, size, false, get_alloc_prev(block));
+    // New bytes past the fresh mark are zero, but coalescing buries the
+    // old epilogue and the footer of a free block before it in the block
+    if (fresh < block->payload + link_size) {
+        fresh = block->payload + link_size;
+    }
+    if (fresh > arena->fresh) {
+        arena->fresh = fresh;
+    }
 
-    // Create new epilogue header
-    block_t *block_next = find_next(block);
-    // // printf("called it line 633");
+    // Create new epilogue header first, so that write_block can set its
+    // flags for a new block that is only a mini block
+    block_t *block_next = (block_t *)((char *)block + size);
     write_epilogue(block_next, false);
+    arena->epilogue = block_next;
+
+    // A new segment has a wilderness of its own; the old one's top block
+    // joins the lists
+    if (!at_top && arena->wild != NULL) {
+        block_t *old = arena->wild;
+        arena->wild = NULL;
+        block_insertion(arena, old);
+    }
+
+    write_block(arena, block, size, false, get_alloc_prev(block));
 
     // Coalesce in case the previous block was free
-    block = coalesce_block(block);
+    block = coalesce_block(arena, block);
 
     // insert block into seglists
-    block_insertion(block);
+    block_insertion(arena, block);
 
     return block;
 }
@@ -773,169 +1813,2148 @@ static block_t *extend_heap(size_t size) {
 /**
  * @brief
  *
- * splits the amount of free block into allocated and leftover free
+ * Gives the free block at the top of the heap back to memlib, keeping
+ * `pad` bytes of it, and never less than a minimum block, free for later
+ * requests. memlib only shrinks the heap from the top, so only the arena
+ * whose newest segment ends there can trim.
  *
- * @param[in] block block that needs to be inserted
- * @param[in] asize actual size of memory needed for the block
+ * @param[in] arena the arena to trim
+ * @param[in] pad free bytes to keep at the top of the heap
+ * @return true if any memory was given back
+ * @pre the arena's lock is held
  */
-static void split_block(block_t *block, size_t asize) {
-    dbg_requires(get_alloc(block));
-    dbg_requires(asize >= min_block_size);
-    size_t block_size = get_size(block);
+static bool heap_trim(arena_t *arena, size_t pad) {
+    block_t *epilogue = arena->epilogue;
+    if (epilogue == NULL || get_alloc_prev(epilogue)) {
+        return false;
+    }
+    block_t *block = find_prev(epilogue);
+    size_t size = get_size(block);
+    if (pad >= size) {
+        return false;
+    }
+    size_t keep = max(round_up(pad, dsize), min_block_size);
+    if (keep >= size) {
+        return false;
+    }
 
-    if ((block_size - asize) >= min_block_size) {
-        block_t *block_next;
-        write_block(block, asize, true, get_alloc_prev(block));
+    lock_heap();
+    if ((char *)epilogue != (char *)mem_heap_hi() - 7) {
+        unlock_heap();
+        return false;
+    }
 
-        block_next = find_next(block);
-        write_block(block_next, block_size - asize, false, true);
+    // Shrink the block, moving the epilogue down behind it, then cut the
+    // heap off after the new epilogue
+    block_removal(arena, block);
+    block_t *block_next = (block_t *)((char *)block + keep);
+    write_epilogue(block_next, false);
+    arena->epilogue = block_next;
+    write_block(arena, block, keep, false, get_alloc_prev(block));
+    block_insertion(arena, block);
+    mem_sbrk(-(intptr_t)(size - keep));
+    unlock_heap();
+    arena->grow_streak = 0;
+    return true;
+}
 
-        // insert free block into seglists
-        block_insertion(block_next);
+/**
+ * @brief Returns the length of the mapping that holds a `size`-byte
+ * request: a padding word, so the payload is 16-byte aligned, the header
+ * and the payload, rounded up to whole pages.
+ * @param[in] size the requested payload size
+ * @return the mapping length, or 0 if it would overflow
+ */
+static size_t map_length(size_t size) {
+    size_t page = mem_pagesize();
+    if (size > SIZE_MAX - dsize - page) {
+        return 0;
     }
-
-    dbg_ensures(get_alloc(block));
+    return round_up(size + dsize, page);
 }
 
 /**
  * @brief
  *
- * finds a block that was previously freed to insert a new block
- * searches through the first 35 entries in each segmented lists bucket
+ * Serves a request from a fresh mapping outside the heap. The mapping
+ * holds a single allocated block, which never takes part in the seglists
+ * or coalescing and is unmapped as soon as it is freed. The block header
+ * records the length of the whole mapping rather than of the block.
  *
- * @param[in] asize size of the block that needs to be inserted into heap
- * @return
+ * @param[in] arena the arena recorded as the block's owner
+ * @param[in] size the requested payload size
+ * @return the payload, or NULL if the region could not be mapped
  */
-static block_t *find_fit(size_t asize) {
+static void *map_malloc(arena_t *arena, size_t size) {
+    size_t len = map_length(size);
+    if (len == 0) {
+        return NULL;
+    }
 
-    size_t index = find_size_list(asize);
-    size_t count = 0;
-    block_t *best = NULL;
-    size_t diff = 100;
-    size_t d = 0;
-    while (index < 15) {
+    lock_heap();
+    void *region = mem_map(len);
+    unlock_heap();
+    if (region == (void *)-1) {
+        return NULL;
+    }
 
-        for (block_t *curr = list_heads[index]; curr != NULL && count < 35;
-             curr = curr->next) {
-            count++;
-            d = get_size(curr) - asize;
-            if (asize <= get_size(curr) && (best == NULL || d)) {
-                best = curr;
-                diff = d;
-            }
-        }
-        if (best != NULL) {
-            return best;
-        }
-        count = 0;
+    block_t *block = (block_t *)((char *)region + wsize);
+    block->header =
+        pack(len, true, true, false) | arena_tag(arena) | mask_mapped;
+    return header_to_payload(block);
+}
 
-        index++;
-    }
-    return NULL;
+/**
+ * @brief Unmaps a block served by map_malloc.
+ * @param[in] block the mapped block
+ */
+static void map_free(block_t *block) {
+    dbg_requires(get_mapped(block));
+    lock_heap();
+    mem_unmap((char *)block - wsize, get_size(block));
+    unlock_heap();
 }
 
 /**
- * @brief
- *
- * makes sures that the heap is correct and that all the block
- * information is being stored appropriately (does all the checks
- * on the writeup).
- *
- * @param[in] line line number that the function is called
- * @return
+ * @brief Resizes a block served by map_malloc without moving it.
+ * @param[in] block the mapped block
+ * @param[in] size the new payload size
+ * @return true if the mapping now holds `size` bytes, false if it could
+ *         not grow in place
  */
-bool mm_checkheap(int line) {
+static bool map_resize(block_t *block, size_t size) {
+    size_t len = map_length(size);
+    size_t old_len = get_size(block);
+    if (len == 0) {
+        return false;
+    }
+    if (len == old_len) {
+        return true;
+    }
 
-    // printf("checkheap %d\n ", line);
-    word_t *prologueinfo = find_prev_footer(heap_start);
-    if (!(extract_alloc(*prologueinfo) && extract_size(*prologueinfo) == 0)) {
+    lock_heap();
+    void *region = mem_remap((char *)block - wsize, old_len, len);
+    unlock_heap();
+    if (region == (void *)-1) {
         return false;
     }
-    size_t freeblocks = 0;
-    bool lastfree = false;
-    block_t *block;
-    for (block = heap_start; get_size(block) > 0; block = find_next(block)) {
-        if (get_alloc(block)) {
-            // printf("A ");
-        } else {
-            // printf("F ");
-        }
-        // printf("%zu | ", get_size(block));
-        // if (get_size(block) < min_block_size) {
-        //     return false;
-        // }
-        if (get_size(block) % 16 != 0) {
-            // printf("false line 718");
+
+    block->header = (block->header & ~size_mask) | len;
+    return true;
+}
+
+/**
+ * @brief Records that an allocated block may now be written, so neither
+ * its bytes nor the header and links of a free block after it are fresh.
+ * @param[in] arena the arena the block belongs to
+ * @param[in] block an allocated block
+ */
+static void mark_used(arena_t *arena, block_t *block) {
+    char *end = find_next(block)->payload + link_size;
+    if (end > arena->fresh) {
+        arena->fresh = end;
+    }
+}
+
+/**
+ * @brief
+ *
+ * splits the amount of free block into allocated and leftover free
+ *
+ * @param[in] arena the arena the block belongs to
+ * @param[in] block block that needs to be inserted
+ * @param[in] asize actual size of memory needed for the block
+ */
+static void split_block(arena_t *arena, block_t *block, size_t asize) {
+    dbg_requires(get_alloc(block));
+    dbg_requires(asize >= min_block_size);
+    size_t block_size = get_size(block);
+
+    if ((block_size - asize) >= min_block_size) {
+        block_t *block_next;
+        stat_add(&stats.splits, 1);
+        write_block(arena, block, asize, true, get_alloc_prev(block));
+
+        block_next = find_next(block);
+        write_block(arena, block_next, block_size - asize, false, true);
+
+        // insert free block into seglists
+        block_insertion(arena, block_next);
+    }
+    mark_used(arena, block);
+
+    dbg_ensures(get_alloc(block));
+}
+
+#ifdef TWO_ENDED
+/**
+ * @brief
+ *
+ * Like split_block, but places the allocation at the high end of the
+ * block and hands the low end back to the seglists, so that large blocks
+ * collect above the small ones carved from the low ends of their fits.
+ * The block before the epilogue is still split from its low end, so the
+ * wilderness stays at the top of the heap.
+ *
+ * @param[in] arena the arena the block belongs to
+ * @param[in] block allocated block to split
+ * @param[in] asize actual size of memory needed for the block
+ * @return the allocated block, at the low or high end
+ */
+static block_t *split_block_high(arena_t *arena, block_t *block,
+                                 size_t asize) {
+    dbg_requires(get_alloc(block));
+    dbg_requires(asize >= min_block_size);
+    size_t block_size = get_size(block);
+
+    if (block_size - asize < min_block_size ||
+        find_next(block) == arena->epilogue) {
+        split_block(arena, block, asize);
+        return block;
+    }
+
+    // the blocks around the fit are allocated, so the low end needs no
+    // coalescing
+    stat_add(&stats.splits, 1);
+    write_block(arena, block, block_size - asize, false,
+                get_alloc_prev(block));
+    block_insertion(arena, block);
+    block = find_next(block);
+    write_block(arena, block, asize, true, false);
+    mark_used(arena, block);
+
+    dbg_ensures(get_alloc(block));
+    return block;
+}
+#endif /* def TWO_ENDED */
+
+/**
+ * @brief
+ *
+ * Trims an allocated block down to asize, handing the tail back as a free
+ * block. Unlike split_block, the tail may border a free block (realloc
+ * shrinking in place), so it is coalesced before it is inserted.
+ *
+ * @param[in] arena the arena the block belongs to
+ * @param[in] block allocated block to trim
+ * @param[in] asize size the block should keep
+ */
+static void shrink_block(arena_t *arena, block_t *block, size_t asize) {
+    dbg_requires(get_alloc(block));
+    dbg_requires(asize >= min_block_size);
+    size_t block_size = get_size(block);
+
+    if ((block_size - asize) >= min_block_size) {
+        stat_add(&stats.splits, 1);
+        write_block(arena, block, asize, true, get_alloc_prev(block));
+
+        block_t *rest = find_next(block);
+        write_block(arena, rest, block_size - asize, false, true);
+        block_insertion(arena, coalesce_block(arena, rest));
+    }
+    mark_used(arena, block);
+
+    dbg_ensures(get_alloc(block));
+}
+
+/**
+ * @brief
+ *
+ * Grows an allocated block in place by absorbing the free block after it,
+ * extending the heap first when the block (or the free block after it)
+ * is the last one before the epilogue.
+ *
+ * @param[in] arena the arena the block belongs to
+ * @param[in] block allocated block to grow
+ * @param[in] asize size the block needs to reach
+ * @return true if the block now has at least asize bytes, false otherwise
+ */
+static bool grow_block(arena_t *arena, block_t *block, size_t asize) {
+    size_t block_size = get_size(block);
+    block_t *next = find_next(block);
+    size_t avail = block_size;
+
+    if (!get_alloc(next)) {
+        avail += get_size(next);
+    }
+
+    bool at_tail = next == arena->epilogue ||
+                   (!get_alloc(next) && find_next(next) == arena->epilogue);
+    if (avail < asize && at_tail) {
+        // the new free block coalesces with a free next, so it becomes next
+        if (extend_heap(arena, asize - avail) == NULL) {
             return false;
         }
+        next = find_next(block);
+        avail = block_size + get_size(next);
+    }
 
-        if (!get_alloc(block)) {
-            freeblocks++;
-            if (lastfree) {
-                // printf("false line 728");
-                return false;
-            } else {
-                lastfree = true;
-            }
-        } else {
+    if (get_alloc(next) || avail < asize) {
+        return false;
+    }
 
-            lastfree = false;
-        }
+    block_removal(arena, next);
+    write_block(arena, block, avail, true, get_alloc_prev(block));
+    shrink_block(arena, block, asize);
+    return true;
+}
+
+/**
+ * @brief
+ *
+ * Grows an allocated block in place by merging it with the free block
+ * before it (and the free block after it, if any), sliding the payload
+ * down to the start of the merged block.
+ *
+ * @param[in] arena the arena the block belongs to
+ * @param[in] block allocated block to grow
+ * @param[in] asize size the block needs to reach
+ * @return the merged block, or NULL if the neighbours are too small
+ */
+static block_t *grow_block_down(arena_t *arena, block_t *block,
+                                size_t asize) {
+    if (get_alloc_prev(block)) {
+        return NULL;
     }
-    // printf("\n");
-    if (!(get_alloc(block) && get_size(block) == 0)) {
-        // printf("false line 741\n");
-        // printf("size %zu ", get_size(block));
-        if (get_alloc(block)) {
-            // printf("alloced\n ");
+
+    block_t *prev = find_prev(block);
+    block_t *next = find_next(block);
+    size_t avail = get_size(prev) + get_size(block);
+    if (!get_alloc(next)) {
+        avail += get_size(next);
+    }
+    if (avail < asize) {
+        return NULL;
+    }
+
+    block_removal(arena, prev);
+    if (!get_alloc(next)) {
+        block_removal(arena, next);
+    }
+    memmove(header_to_payload(prev), header_to_payload(block),
+            get_payload_size(block));
+    write_block(arena, prev, avail, true, get_alloc_prev(prev));
+    shrink_block(arena, prev, asize);
+    return prev;
+}
+
+/**
+ * @brief
+ *
+ * finds the best fit for a new block: the smallest free block of at
+ * least asize bytes, and the lowest addressed one among equals. Only
+ * asize's own class can hold blocks too small for it, and only if it is
+ * a tree, so a lookup in that tree comes first. Otherwise the first
+ * non-empty class above it, found with a find-first-set on list_bitmap,
+ * holds the best fit: the head of a single-size list or the smallest
+ * block of a tree, which tree_mins gives without walking down to it
+ * through the cold nodes above. The wilderness, which no list holds, is
+ * only split when no listed block is a tighter fit; with the lists empty,
+ * as in a run of allocations, it is taken at once and carved like a bump
+ * pointer.
+ *
+ * Under NEXT_FIT, a class's search resumes at its rover, the block after
+ * the one it returned last, as long as that block fits; the search only
+ * starts from the front again once the rover runs off the end.
+ *
+ * @param[in] arena the arena whose lists are searched
+ * @param[in] asize size of the block that needs to be inserted into heap
+ * @return the best fitting free block, or NULL if none is large enough
+ */
+static block_t *find_fit(arena_t *arena, size_t asize) {
+    block_t *best = NULL;
+    size_t visited = 0;
+    size_t index = find_size_list(asize);
+    word_t candidates = arena->list_bitmap & (~(word_t)0 << index);
+
+    if ((candidates >> index) & 1) {
+        block_t *rover = arena->rovers[index];
+        if (next_fit && rover != NULL && get_size(rover) >= asize) {
+            best = rover;
+            visited++;
+        } else if (index >= ordered_class) {
+            best = tree_best_fit(arena->list_heads[index], asize, &visited);
         } else {
-            // printf("not\n");
+            best = arena->list_heads[index];
+            visited++;
+        }
+        candidates &= candidates - 1;
+    }
+    if (best == NULL && candidates != 0) {
+        index = (size_t)__builtin_ctzll(candidates);
+        best = index >= ordered_class ? arena->tree_mins[index]
+                                      : arena->list_heads[index];
+        if (next_fit && arena->rovers[index] != NULL) {
+            best = arena->rovers[index];
+        }
+        visited++;
+    }
+    block_t *wild = arena->wild;
+    if (wild != NULL) {
+        visited++;
+    }
+    stat_search(visited);
+    if (wild != NULL && get_size(wild) >= asize &&
+        (best == NULL || get_size(wild) < get_size(best))) {
+        return wild;
+    }
+    if (best != NULL) {
+        index = find_size_list(get_size(best));
+        arena->list_hits[index]++;
+        if (next_fit) {
+            arena->rovers[index] = best;
         }
-        return false;
     }
+    return best;
+}
 
-    size_t freelinks = 0;
-    for (size_t i = 0; i < 15; i++) {
-        block_t *head = list_heads[i];
-        printf("\nbucket %zu ", i);
-        for (block_t *curr = head; curr != NULL; curr = curr->next) {
+/**
+ * @brief Returns how far a block's payload must move up to reach an
+ * `align`-byte boundary, leaving room for a free block in front of it.
+ * @param[in] block a block, or the epilogue a new block would replace
+ * @param[in] align a power of two
+ * @return 0, or a lead of at least min_block_size
+ */
+static size_t aligned_lead(block_t *block, size_t align) {
+    uintptr_t payload = (uintptr_t)block->payload;
+    uintptr_t aligned = (uintptr_t)round_up(payload, align);
+    while (aligned != payload && aligned - payload < min_block_size) {
+        aligned += align;
+    }
+    return (size_t)(aligned - payload);
+}
 
-            printf("node size %zu |", get_size(curr));
+/**
+ * @brief Finds the first block of a size tree, in size order, that still
+ * holds asize bytes once its payload is moved up to an `align`-byte
+ * boundary. Any block of asize + align + min_block_size bytes does, which
+ * bounds how far the in-order walk goes.
+ * @param[in] root the root of the tree
+ * @param[in] asize size of the block, including its header
+ * @param[in] align required payload alignment, a power of two
+ * @return a fitting free block, or NULL
+ */
+static block_t *tree_aligned_fit(block_t *root, size_t asize, size_t align) {
+    if (root == NULL) {
+        return NULL;
+    }
+    if (get_size(root) >= asize) {
+        block_t *fit = tree_aligned_fit(root->left, asize, align);
+        if (fit != NULL) {
+            return fit;
+        }
+        if (aligned_lead(root, align) + asize <= get_size(root)) {
+            return root;
+        }
+    }
+    return tree_aligned_fit(root->right, asize, align);
+}
 
-            if (i != find_size_list(get_size(curr))) {
-                // printf("false line 751");
-                return false;
-            }
-            freelinks++;
-            if (get_alloc(curr)) {
-                // printf("false line 756");
-                return false;
-            }
-            if (curr < (block_t *)mem_heap_lo() ||
-                curr > (block_t *)mem_heap_hi()) {
-                // printf("false line 761");
-                return false;
+/**
+ * @brief
+ *
+ * Like find_fit, but only accepts a free block that still holds asize
+ * bytes once its payload is moved up to an `align`-byte boundary, and
+ * tries the wilderness last.
+ *
+ * @param[in] arena the arena whose lists are searched
+ * @param[in] asize size of the block, including its header
+ * @param[in] align required payload alignment, a power of two
+ * @return a fitting free block, or NULL
+ */
+static block_t *find_aligned_fit(arena_t *arena, size_t asize,
+                                 size_t align) {
+    size_t index = find_size_list(asize);
+    word_t candidates = arena->list_bitmap & (~(word_t)0 << index);
+    while (candidates != 0) {
+        index = (size_t)__builtin_ctzll(candidates);
+        if (index >= ordered_class) {
+            block_t *fit =
+                tree_aligned_fit(arena->list_heads[index], asize, align);
+            if (fit != NULL) {
+                return fit;
             }
-            if (curr != head && curr->next != NULL &&
-                get_size(curr->next) > min_block_size) {
-                if (!(curr == curr->next->prev)) {
-                    // printf("false line 765");
-                    return false;
-                }
+            candidates &= candidates - 1;
+            continue;
+        }
+        size_t count = 0;
+        for (block_t *curr = arena->list_heads[index];
+             curr != NULL && count < aligned_search_max;
+             curr = curr->next) {
+            count++;
+            if (aligned_lead(curr, align) + asize <= get_size(curr)) {
+                return curr;
             }
         }
+        candidates &= candidates - 1;
     }
-    // printf("\n");
-    if (freelinks != freeblocks) {
+    block_t *wild = arena->wild;
+    if (wild != NULL && aligned_lead(wild, align) + asize <= get_size(wild)) {
+        return wild;
+    }
+    return NULL;
+}
+
+/**
+ * @brief
+ *
+ * Allocates a block whose payload starts on an `align`-byte boundary. The
+ * space in front of the payload, if any, is split off as a free block of
+ * at least min_block_size, and split_block returns the tail.
+ *
+ * When nothing fits, the heap grows by just enough for the aligned block
+ * to end the arena's newest segment, counting the free block already at
+ * its end; only if that space lands elsewhere is the heap grown by the
+ * full worst-case slack.
+ *
+ * @param[in] arena the arena to allocate from
+ * @param[in] asize size of the block, including its header
+ * @param[in] align required payload alignment, a power of two
+ * @return the allocated block, or NULL if the heap cannot grow
+ */
+static block_t *place_aligned(arena_t *arena, size_t asize, size_t align) {
+    block_t *block = find_aligned_fit(arena, asize, align);
+    if (block == NULL && fast_consolidate(arena)) {
+        block = find_aligned_fit(arena, asize, align);
+    }
+    if (block == NULL && arena->epilogue != NULL) {
+        block_t *start = arena->epilogue;
+        if (!get_alloc_prev(start)) {
+            start = find_prev(start);
+        }
+        size_t end = (size_t)((char *)start - (char *)arena->epilogue) +
+                     aligned_lead(start, align) + asize;
+        if (extend_heap(arena, end) != NULL) {
+            block = find_aligned_fit(arena, asize, align);
+        }
+    }
+    if (block == NULL) {
+        if (extend_heap(arena, asize + align + min_block_size) == NULL) {
+            return NULL;
+        }
+        block = find_aligned_fit(arena, asize, align);
+        dbg_assert(block != NULL);
+    }
+    block_removal(arena, block);
+
+    size_t lead = aligned_lead(block, align);
+    size_t block_size = get_size(block);
+
+    if (lead > 0) {
+        // the fit's neighbours are allocated, so the lead needs no coalescing
+        write_block(arena, block, lead, false, get_alloc_prev(block));
+        block_insertion(arena, block);
+        block = find_next(block);
+        block_size -= lead;
+        write_block(arena, block, block_size, true, false);
+    } else {
+        write_block(arena, block, block_size, true, get_alloc_prev(block));
+    }
+    split_block(arena, block, asize);
+    return block;
+}
+
+/**
+ * @brief Returns the slab class serving a request, one per 16 bytes.
+ * @param[in] size the requested payload size, at most slab_max
+ * @return the class index
+ */
+static size_t slab_class(size_t size) {
+    return (size - 1) >> 4;
+}
+
+/**
+ * @brief Decides whether a request is served from a slab. That only pays
+ * off when the block header would push the request into the next 16-byte
+ * step, i.e. when the request ends in the last 8 bytes of a step; for the
+ * other sizes a block costs as much as a slab object.
+ * @param[in] size the requested payload size
+ * @return true if the request should come from a slab
+ */
+static bool slab_fits(size_t size) {
+    return size != 0 && size <= slab_max &&
+           (size % dsize == 0 || size % dsize > wsize);
+}
+
+/**
+ * @brief Returns the slab holding a pointer, looking the page the pointer
+ * falls in up in slab_pages.
+ * @param[in] bp a payload handed out by malloc
+ * @return the slab holding bp, or NULL if bp is an ordinary block
+ */
+static slab_t *find_slab(void *bp) {
+    size_t page = (size_t)(((uintptr_t)bp - slab_base) / slab_size);
+    if (page >= SLAB_PAGE_WORDS * 64) {
+        return NULL;
+    }
+    word_t bits =
+        __atomic_load_n(&slab_pages[page / 64], __ATOMIC_RELAXED);
+    if (((bits >> (page % 64)) & 1) == 0) {
+        return NULL;
+    }
+    return (slab_t *)(slab_base + page * slab_size);
+}
+
+/**
+ * @brief Marks or clears a page in slab_pages.
+ * @param[in] slab the slab starting the page
+ * @param[in] live true if the slab is being created
+ */
+static void mark_slab_page(slab_t *slab, bool live) {
+    size_t page = (size_t)(((uintptr_t)slab - slab_base) / slab_size);
+    word_t bit = (word_t)1 << (page % 64);
+    if (live) {
+        __atomic_fetch_or(&slab_pages[page / 64], bit, __ATOMIC_RELAXED);
+    } else {
+        __atomic_fetch_and(&slab_pages[page / 64], ~bit, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief Returns the address of an object in a slab.
+ * @param[in] slab
+ * @param[in] index the object's position in the slab
+ * @return the object's address
+ */
+static void *slab_object(slab_t *slab, size_t index) {
+    return (char *)slab + round_up(sizeof(slab_t), dsize) +
+           index * slab->obj_size;
+}
+
+/**
+ * @brief
+ *
+ * Carves a new slab for one class out of the arena's heap and puts it at
+ * the front of the class's list. Fails when the heap cannot grow or when
+ * the slab would land above the part of the heap slab_pages covers.
+ *
+ * @param[in] arena the arena to carve the slab from
+ * @param[in] index the slab class
+ * @return the new slab, or NULL on failure
+ */
+static slab_t *slab_create(arena_t *arena, size_t index) {
+    size_t asize = round_up(slab_size + wsize, dsize);
+    block_t *block = place_aligned(arena, asize, slab_size);
+    if (block == NULL) {
+        return NULL;
+    }
+
+    slab_t *slab = (slab_t *)header_to_payload(block);
+    size_t page = (size_t)(((uintptr_t)slab - slab_base) / slab_size);
+    if (page >= SLAB_PAGE_WORDS * 64) {
+        write_block(arena, block, get_size(block), false,
+                    get_alloc_prev(block));
+        block_insertion(arena, coalesce_block(arena, block));
+        return NULL;
+    }
+
+    slab->obj_size = (index + 1) * dsize;
+    slab->capacity =
+        (slab_size - round_up(sizeof(slab_t), dsize)) / slab->obj_size;
+    slab->nfree = slab->capacity;
+    slab->arena = arena;
+    for (size_t i = 0; i < SLAB_MAP_WORDS; i++) {
+        size_t first = i * 64;
+        if (slab->capacity >= first + 64) {
+            slab->free_map[i] = ~(word_t)0;
+        } else if (slab->capacity > first) {
+            slab->free_map[i] = ((word_t)1 << (slab->capacity - first)) - 1;
+        } else {
+            slab->free_map[i] = 0;
+        }
+    }
+
+    slab->prev = NULL;
+    slab->next = arena->slabs[index];
+    if (slab->next != NULL) {
+        slab->next->prev = slab;
+    }
+    arena->slabs[index] = slab;
+    mark_slab_page(slab, true);
+    return slab;
+}
+
+/**
+ * @brief Takes a slab out of its class's list of slabs with free objects.
+ * @param[in] arena the arena owning the slab
+ * @param[in] slab the slab to unlink
+ */
+static void slab_unlink(arena_t *arena, slab_t *slab) {
+    size_t index = slab_class(slab->obj_size);
+    if (slab->prev == NULL) {
+        arena->slabs[index] = slab->next;
+    } else {
+        slab->prev->next = slab->next;
+    }
+    if (slab->next != NULL) {
+        slab->next->prev = slab->prev;
+    }
+    slab->next = NULL;
+    slab->prev = NULL;
+}
+
+/**
+ * @brief
+ *
+ * Hands out an object from the first slab of the request's class with a
+ * free object, creating a slab when there is none and the class has
+ * enough demand for one
+ *
+ * @param[in] arena the arena to allocate from
+ * @param[in] size the requested payload size, which slab_fits accepted
+ * @return the object, or NULL if the request should use a block instead
+ */
+static void *slab_malloc(arena_t *arena, size_t size) {
+    size_t index = slab_class(size);
+    slab_t *slab = arena->slabs[index];
+    if (slab == NULL) {
+        // A slab costs a page whatever its occupancy, so only carve one once
+        // the class has more live requests than it would take to fill a page
+        // with ordinary blocks
+        size_t block_size = (index + 2) * dsize;
+        if (arena->slab_demand[index] < slab_size / block_size) {
+            arena->slab_demand[index]++;
+            return NULL;
+        }
+        slab = slab_create(arena, index);
+        if (slab == NULL) {
+            return NULL;
+        }
+    }
+
+    size_t word = 0;
+    while (slab->free_map[word] == 0) {
+        word++;
+    }
+    size_t bit = (size_t)__builtin_ctzll(slab->free_map[word]);
+    slab->free_map[word] &= slab->free_map[word] - 1;
+    slab->nfree--;
+    if (slab->nfree == 0) {
+        slab_unlink(arena, slab);
+    }
+    return slab_object(slab, word * 64 + bit);
+}
+
+/**
+ * @brief
+ *
+ * Returns an object to its slab. A slab that becomes empty goes back to
+ * the seglist heap, unless it is the only slab its class has left, which
+ * saves carving a new one if the next request is for the same class.
+ *
+ * @param[in] arena the arena owning the slab
+ * @param[in] slab the slab holding the object
+ * @param[in] bp the object being freed
+ */
+static void slab_free(arena_t *arena, slab_t *slab, void *bp) {
+    size_t offset = (size_t)((char *)bp - (char *)slab_object(slab, 0));
+    size_t i = offset / slab->obj_size;
+    dbg_requires(offset % slab->obj_size == 0);
+    dbg_requires((slab->free_map[i / 64] & ((word_t)1 << (i % 64))) == 0);
+
+    slab->free_map[i / 64] |= (word_t)1 << (i % 64);
+    slab->nfree++;
+    size_t index = slab_class(slab->obj_size);
+    if (slab->nfree == 1) {
+        slab->prev = NULL;
+        slab->next = arena->slabs[index];
+        if (slab->next != NULL) {
+            slab->next->prev = slab;
+        }
+        arena->slabs[index] = slab;
+    }
+
+    bool last = arena->slabs[index] == slab && slab->next == NULL;
+    if (slab->nfree == slab->capacity && !last) {
+        slab_unlink(arena, slab);
+        mark_slab_page(slab, false);
+        block_t *block = payload_to_header(slab);
+        write_block(arena, block, get_size(block), false,
+                    get_alloc_prev(block));
+        block_insertion(arena, coalesce_block(arena, block));
+    }
+}
+
+/**
+ * @brief Returns the arena owning a payload handed out by malloc, which
+ * is recorded in the slab for a slab object and in the header otherwise.
+ * @param[in] bp the payload
+ * @return the owning arena
+ */
+static arena_t *payload_arena(void *bp) {
+    slab_t *slab = find_slab(bp);
+    if (slab != NULL) {
+        return slab->arena;
+    }
+    return arena_of(payload_to_header(bp));
+}
+
+/**
+ * @brief Returns how many bytes of a payload handed out by malloc the
+ * caller may use: the whole slab object, the mapping past its padding
+ * word and header, or the block's payload, including any tail that was
+ * too small to split off.
+ * @param[in] bp the payload
+ * @return the usable size in bytes
+ */
+static size_t usable_size(void *bp) {
+    slab_t *slab = find_slab(bp);
+    if (slab != NULL) {
+        return slab->obj_size;
+    }
+    word_t header = read_header(payload_to_header(bp));
+    if ((header & mask_mapped) != 0) {
+        return extract_size(header) - dsize;
+    }
+    return extract_size(header) - wsize;
+}
+
+/**
+ * @brief Counts a payload handed out to the caller in stats.
+ * @param[in] bp the payload, or NULL if the allocation failed
+ */
+static void stat_alloc(void *bp) {
+    if (stats_enabled && bp != NULL) {
+        stat_add(&stats.mallocs, 1);
+        stat_add(&stats.bytes_in_use, usable_size(bp));
+    }
+}
+
+/**
+ * @brief Counts a payload about to be freed in stats.
+ * @param[in] bp the payload, which must still be allocated
+ */
+static void stat_free(void *bp) {
+    if (stats_enabled) {
+        stat_add(&stats.frees, 1);
+        stat_add(&stats.bytes_in_use, -usable_size(bp));
+    }
+}
+
+/**
+ * @brief
+ *
+ * Checks a subtree of one of an arena's size trees: every node is a free
+ * block of the arena and the tree's class, links back to its parent, and
+ * has a key strictly between lo and hi, no red node has a red child, and
+ * every path down holds the same number of black nodes.
+ *
+ * @param[in] arena the arena owning the tree
+ * @param[in] index the size class of the tree
+ * @param[in] node the root of the subtree
+ * @param[in] parent the node above it, or NULL
+ * @param[in] lo a block every key must follow, or NULL
+ * @param[in] hi a block every key must precede, or NULL
+ * @param[out] count number of nodes, added to
+ * @return the black height of the subtree, or -1 if it is inconsistent
+ */
+static int tree_check(arena_t *arena, size_t index, block_t *node,
+                      block_t *parent, block_t *lo, block_t *hi,
+                      size_t *count) {
+    if (node == NULL) {
+        return 1;
+    }
+    if (node < (block_t *)mem_heap_lo() || node > (block_t *)mem_heap_hi() ||
+        get_alloc(node) || find_size_list(get_size(node)) != index ||
+        (node->header & arena_mask) != arena_tag(arena) ||
+        node->parent != parent) {
+        return -1;
+    }
+    if ((lo != NULL && !tree_before(lo, node)) ||
+        (hi != NULL && !tree_before(node, hi))) {
+        return -1;
+    }
+    if (node->red && (tree_red(node->left) || tree_red(node->right))) {
+        return -1;
+    }
+    (*count)++;
+    int left = tree_check(arena, index, node->left, node, lo, node, count);
+    int right = tree_check(arena, index, node->right, node, node, hi, count);
+    if (left < 0 || left != right) {
+        return -1;
+    }
+    return left + (node->red ? 0 : 1);
+}
+
+/**
+ * @brief Checks one of an arena's lists: a tree passes tree_check, and
+ * every block of a single-size list is a free block of the arena and the
+ * list's class, linked both ways. Either way the list holds as many
+ * blocks as list_counts says, list_bitmap knows whether it is empty, and
+ * the list's rover, if any, is one of its blocks.
+ * @param[in] arena the arena owning the list
+ * @param[in] i the list
+ * @param[in,out] freelinks incremented for every block in the list
+ * @return true if the list is consistent, false otherwise
+ */
+static bool check_list(arena_t *arena, size_t i, size_t *freelinks) {
+    size_t count = 0;
+    block_t *head = arena->list_heads[i];
+    block_t *rover = arena->rovers[i];
+    if ((head != NULL) != ((arena->list_bitmap >> i) & 1)) {
+        return false;
+    }
+    if (i >= ordered_class) {
+        size_t visited = 0;
+        if (tree_red(head) ||
+            tree_check(arena, i, head, NULL, NULL, NULL, &count) < 0 ||
+            count != arena->list_counts[i] ||
+            arena->tree_mins[i] != tree_best_fit(head, 0, &visited)) {
+            return false;
+        }
+        if (rover != NULL) {
+            if (rover < (block_t *)mem_heap_lo() ||
+                rover > (block_t *)mem_heap_hi()) {
+                return false;
+            }
+            block_t *node = head;
+            while (node != NULL && node != rover) {
+                node = tree_before(rover, node) ? node->left : node->right;
+            }
+            if (node == NULL) {
+                return false;
+            }
+        }
+        *freelinks += count;
+        return true;
+    }
+    bool rover_found = rover == NULL;
+    for (block_t *curr = head; curr != NULL; curr = curr->next) {
+        rover_found |= curr == rover;
+        if (i != find_size_list(get_size(curr))) {
+            return false;
+        }
+        count++;
+        if (get_alloc(curr)) {
+            return false;
+        }
+        if (curr < (block_t *)mem_heap_lo() ||
+            curr > (block_t *)mem_heap_hi()) {
+            return false;
+        }
+        if (i != 0 && (curr->header & arena_mask) != arena_tag(arena)) {
+            return false;
+        }
+        if (curr != head && curr->next != NULL &&
+            get_size(curr->next) > min_block_size) {
+            if (!(curr == curr->next->prev)) {
+                return false;
+            }
+        }
+        if (i == 0 && curr->next != NULL && get_mini_prev(curr->next) != curr) {
+            return false;
+        }
+    }
+    *freelinks += count;
+    return rover_found && count == arena->list_counts[i];
+}
+
+/**
+ * @brief Checks that the free block at the top of an arena's newest
+ * segment, and only that block, is the arena's wilderness, which no list
+ * holds.
+ * @param[in] arena the arena to check
+ * @param[in,out] freelinks incremented if the arena has a wilderness
+ * @return true if the wilderness is consistent, false otherwise
+ */
+static bool check_wild(arena_t *arena, size_t *freelinks) {
+    block_t *wild = arena->wild;
+    bool top_free = arena->epilogue != NULL && !get_alloc_prev(arena->epilogue);
+    if (top_free != (wild != NULL)) {
+        return false;
+    }
+    if (wild != NULL) {
+        if (get_alloc(wild) || find_next(wild) != arena->epilogue) {
+            return false;
+        }
+        (*freelinks)++;
+    }
+    return true;
+}
+
+/**
+ * @brief
+ *
+ * Checks the whole heap: walks every segment, every list and every slab
+ * and fast bin, and compares the free blocks found on the heap with the
+ * ones the lists hold.
+ *
+ * @return true if the heap is consistent, false otherwise
+ */
+static bool check_heap(void) {
+    size_t freeblocks = 0;
+    block_t *block = heap_start;
+    // Walk the segments in address order: each one starts right after the
+    // previous segment's epilogue and ends at its own
+    while (true) {
+        word_t *prologueinfo = find_prev_footer(block);
+        if (!(extract_alloc(*prologueinfo) &&
+              extract_size(*prologueinfo) == 0)) {
+            return false;
+        }
+        word_t tag = *prologueinfo & arena_mask;
+        if ((tag >> arena_shift) >= NUM_ARENAS) {
+            return false;
+        }
+        bool lastfree = false;
+        for (; get_size(block) > 0; block = find_next(block)) {
+            if (get_size(block) % 16 != 0) {
+                // printf("false line 718");
+                return false;
+            }
+            // every block of a segment belongs to the segment's arena; free
+            // mini blocks keep a list link in place of the tag
+            if (!(block->header & mask_mini_free) &&
+                (block->header & arena_mask) != tag) {
+                return false;
+            }
+
+            if (!get_alloc(block)) {
+                freeblocks++;
+                if (lastfree) {
+                    // printf("false line 728");
+                    return false;
+                } else {
+                    lastfree = true;
+                }
+            } else {
+
+                lastfree = false;
+            }
+        }
+        if (!(get_alloc(block) && get_size(block) == 0)) {
+            // printf("false line 741\n");
+            return false;
+        }
+        if ((char *)block + wsize > (char *)mem_heap_hi()) {
+            break;
+        }
+        block = (block_t *)((char *)block + dsize);
+    }
+
+    size_t freelinks = 0;
+    for (size_t k = 0; k < NUM_ARENAS * NUM_LISTS; k++) {
+        if (!check_list(&arenas[k / NUM_LISTS], k % NUM_LISTS, &freelinks)) {
+            return false;
+        }
+    }
+    // Every listed slab is live, sits in an allocated block, belongs to the
+    // arena and class listing it, and has as many free objects as it says
+    for (size_t k = 0; k < NUM_ARENAS * SLAB_CLASSES; k++) {
+        arena_t *arena = &arenas[k / SLAB_CLASSES];
+        size_t i = k % SLAB_CLASSES;
+        for (slab_t *slab = arena->slabs[i]; slab != NULL;
+             slab = slab->next) {
+            if (find_slab(slab) != slab || slab->arena != arena ||
+                slab->obj_size != (i + 1) * dsize ||
+                !get_alloc(payload_to_header(slab))) {
+                return false;
+            }
+            size_t nfree = 0;
+            for (size_t j = 0; j < SLAB_MAP_WORDS; j++) {
+                nfree += (size_t)__builtin_popcountll(slab->free_map[j]);
+            }
+            if (nfree == 0 || nfree != slab->nfree) {
+                return false;
+            }
+            if (slab->next != NULL && slab->next->prev != slab) {
+                return false;
+            }
+        }
+    }
+
+    for (size_t a = 0; a < NUM_ARENAS; a++) {
+        if (!check_wild(&arenas[a], &freelinks)) {
+            return false;
+        }
+    }
+
+    // Every block in a fast bin is an allocated heap block of the bin's
+    // size and arena, and the bins add up to the arena's count
+    for (size_t a = 0; a < NUM_ARENAS; a++) {
+        arena_t *arena = &arenas[a];
+        size_t bytes = 0;
+        for (size_t i = 0; i < FAST_BINS; i++) {
+            for (block_t *curr = arena->fast_heads[i]; curr != NULL;
+                 curr = curr->next) {
+                if (curr < (block_t *)mem_heap_lo() ||
+                    curr > (block_t *)mem_heap_hi() || !get_alloc(curr) ||
+                    get_mapped(curr) || find_size_list(get_size(curr)) != i ||
+                    (curr->header & arena_mask) != arena_tag(arena)) {
+                    return false;
+                }
+                bytes += get_size(curr);
+            }
+        }
+        if (bytes != arena->fast_bytes) {
+            return false;
+        }
+    }
+
+    // printf("\n");
+    if (freelinks != freeblocks) {
+
+        // printf("false line 774 free links %zu free blocks %zu", freelinks,
+        // freeblocks);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Checks that a free block is linked into the list its size
+ * belongs to, or is its arena's wilderness, by looking at the links next
+ * to it only.
+ * @param[in] block a free heap block
+ * @return true if the block is listed, false otherwise
+ */
+static bool check_listed(block_t *block) {
+    size_t size = get_size(block);
+    // a listed mini block keeps its predecessor in place of its arena tag
+    if (block->header & mask_mini_free) {
+        block_t *prev = get_mini_prev(block);
+        if (prev != NULL) {
+            return prev->next == block;
+        }
+        for (size_t a = 0; a < NUM_ARENAS; a++) {
+            if (arenas[a].list_heads[0] == block) {
+                return true;
+            }
+        }
+        return false;
+    }
+    arena_t *arena = arena_of(block);
+    if (block == arena->wild) {
+        return true;
+    }
+    if (size <= min_block_size) {
+        return false;
+    }
+    size_t index = find_size_list(size);
+    if (index >= ordered_class) {
+        if (block->parent == NULL) {
+            return arena->list_heads[index] == block;
+        }
+        return block->parent->left == block || block->parent->right == block;
+    }
+    if (block->prev == NULL) {
+        return arena->list_heads[index] == block;
+    }
+    return block->prev->next == block;
+}
+
+/**
+ * @brief Checks a block taken from a dirty log: its size and arena tag,
+ * the flags the next block keeps about it, and for a free block its
+ * footer, its allocated neighbours and its place in a list.
+ * @param[in] block a block of the heap, not a prologue or epilogue
+ * @return true if the block is consistent, false otherwise
+ */
+static bool check_block(block_t *block) {
+    size_t size = get_size(block);
+    if (size % dsize != 0) {
+        return false;
+    }
+    if (!(block->header & mask_mini_free) &&
+        ((block->header & arena_mask) >> arena_shift) >= NUM_ARENAS) {
+        return false;
+    }
+    block_t *next = find_next(block);
+    if ((char *)next + wsize > (char *)mem_heap_hi() + 1 ||
+        get_alloc_prev(next) != get_alloc(block) ||
+        get_min_status(next) != (size <= min_block_size)) {
+        return false;
+    }
+    if (get_alloc(block)) {
+        return true;
+    }
+    if (!get_alloc_prev(block) || !get_alloc(next)) {
+        return false;
+    }
+    if (size > min_block_size) {
+        word_t footer = *header_to_footer(block);
+        if (extract_size(footer) != size || extract_alloc(footer)) {
+            return false;
+        }
+    }
+    return check_listed(block);
+}
+
+/**
+ * @brief Orders two pointers by address, for qsort.
+ * @param[in] a points to the first pointer
+ * @param[in] b points to the second pointer
+ * @return negative, zero or positive as *a is below, at or above *b
+ */
+static int address_order(const void *a, const void *b) {
+    uintptr_t x = (uintptr_t) * (void *const *)a;
+    uintptr_t y = (uintptr_t) * (void *const *)b;
+    return (x > y) - (x < y);
+}
+
+/** @brief The dirty logs of all arenas, gathered and sorted by check_dirty */
+static block_t *check_blocks[NUM_ARENAS * CHECK_LOG_SIZE];
+
+/**
+ * @brief
+ *
+ * Checks only what changed since the last check: the blocks in the dirty
+ * logs, the lists marked in check_lists and each arena's wilderness. A
+ * logged block that has since been merged lies inside a block written
+ * after it, which is logged too, so the logs are sorted by address and a
+ * block inside one already checked is skipped. Blocks at or above the
+ * top of the heap were trimmed away, and headers of size 0 are the
+ * prologues and epilogues new segments put over old blocks.
+ *
+ * @return true if what changed is consistent, false otherwise
+ */
+static bool check_dirty(void) {
+    size_t n = 0;
+    for (size_t a = 0; a < NUM_ARENAS; a++) {
+        arena_t *arena = &arenas[a];
+        for (size_t i = 0; i < arena->check_logged; i++) {
+            check_blocks[n++] = arena->check_log[i];
+        }
+    }
+    qsort(check_blocks, n, sizeof(*check_blocks), address_order);
+
+    char *checked = NULL; // end of the last block checked
+    for (size_t i = 0; i < n; i++) {
+        block_t *block = check_blocks[i];
+        if ((char *)block < checked ||
+            (char *)block + wsize > (char *)mem_heap_hi() + 1 ||
+            get_size(block) == 0) {
+            continue;
+        }
+        if (!check_block(block)) {
+            return false;
+        }
+        checked = (char *)block + get_size(block);
+    }
+
+    size_t freelinks = 0;
+    for (size_t a = 0; a < NUM_ARENAS; a++) {
+        arena_t *arena = &arenas[a];
+        for (word_t lists = arena->check_lists; lists != 0;
+             lists &= lists - 1) {
+            size_t i = (size_t)__builtin_ctzll(lists);
+            if (!check_list(arena, i, &freelinks)) {
+                return false;
+            }
+        }
+        if (!check_wild(arena, &freelinks)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief
+ *
+ * makes sures that the heap is correct and that all the block
+ * information is being stored appropriately (does all the checks
+ * on the writeup). Every check_period-th call, and any call after a
+ * dirty log overflowed, checks the whole heap (see check_heap); the
+ * others only check what changed since the last call (see check_dirty),
+ * which keeps a check after every operation affordable on long traces.
+ *
+ * @param[in] line line number that the function is called
+ * @return true if the heap is consistent, false otherwise
+ */
+bool mm_checkheap(int line) {
+    bool full = !check_armed || ++check_calls % check_period == 0;
+    for (size_t a = 0; a < NUM_ARENAS; a++) {
+        full = full || arenas[a].check_logged > CHECK_LOG_SIZE;
+    }
+    bool ok = full ? check_heap() : check_dirty();
+
+    for (size_t a = 0; a < NUM_ARENAS; a++) {
+        arenas[a].check_logged = 0;
+        arenas[a].check_lists = 0;
+    }
+    __atomic_store_n(&check_armed, true, __ATOMIC_RELAXED);
+    return ok;
+}
+
+/**
+ * @brief
+ *
+ * Clears the first `size` bytes of a block just taken from a free block,
+ * skipping what already reads as zero: of the bytes that were fresh when
+ * it was taken, only the free block's links and footer were written.
+ *
+ * @param[in] block the allocated block
+ * @param[in] size the number of payload bytes to clear
+ * @param[in] fresh the arena's fresh mark from before the block was taken
+ */
+static void clear_payload(block_t *block, size_t size, char *fresh) {
+    char *payload = block->payload;
+    char *end = payload + size;
+    if (end <= fresh) {
+        memset(payload, 0, size);
+        return;
+    }
+
+    char *dirty = fresh > payload + link_size ? fresh : payload + link_size;
+    if (dirty > end) {
+        dirty = end;
+    }
+    memset(payload, 0, (size_t)(dirty - payload));
+
+    // the footer of a free block that was not split is the last word
+    char *footer = (char *)find_next(block) - wsize;
+    if (footer < dirty) {
+        footer = dirty;
+    }
+    if (end > footer) {
+        memset(footer, 0, (size_t)(end - footer));
+    }
+}
+
+/**
+ * @brief
+ *
+ * allocates the amount of memory given onto the heap
+ * requires the size to be non negative
+ * @param[in] arena the arena to allocate from
+ * @param[in] size size that wants to be alloced onto heap
+ * @param[in] zero whether the first size bytes must read as zero
+ * @return no return
+ * @pre the arena's lock is held
+ */
+static void *heap_malloc(arena_t *arena, size_t size, bool zero) {
+
+    dbg_requires(mm_checkheap(__LINE__));
+
+    size_t asize;      // Adjusted block size
+    size_t extendsize; // Amount to extend heap if no fit is found
+    block_t *block;
+    void *bp = NULL;
+
+    // Ignore spurious request
+    if (size == 0) {
+        dbg_ensures(mm_checkheap(__LINE__));
+        // // printf("\nmalloc END\n");
+        return bp;
+    }
+
+    // Small requests go to a slab, falling back to a block if none can
+    // be created
+    if (slab_fits(size)) {
+        bp = slab_malloc(arena, size);
+        if (bp != NULL) {
+            if (zero) {
+                memset(bp, 0, size);
+            }
+            dbg_ensures(mm_checkheap(__LINE__));
+            return bp;
+        }
+    }
+
+    // Large requests get a mapping of their own, away from the seglists
+    if (size >= __atomic_load_n(&map_threshold, __ATOMIC_RELAXED)) {
+        bp = map_malloc(arena, size);
+        if (zero && bp != NULL) {
+            lock_heap();
+            bool fresh = (char *)bp >= (char *)mem_fresh_lo();
+            unlock_heap();
+            if (!fresh) {
+                memset(bp, 0, size);
+            }
+        }
+        dbg_ensures(mm_checkheap(__LINE__));
+        return bp;
+    }
+
+    // Adjust block size to include overhead and to meet alignment requirements
+    asize = max(round_up(size + wsize, dsize), min_block_size);
+
+    // A block of exactly this size waiting in a fast bin needs no search
+    if (asize <= linear_class_max) {
+        block = fast_get(arena, asize);
+        if (block != NULL) {
+            bp = header_to_payload(block);
+            if (zero) {
+                memset(bp, 0, size);
+            }
+            dbg_ensures(mm_checkheap(__LINE__));
+            return bp;
+        }
+    }
+
+    // Search the free list for a fit, freeing the fast bins for real
+    // before giving up on the lists
+    block = find_fit(arena, asize);
+    if (block == NULL && fast_consolidate(arena)) {
+        block = find_fit(arena, asize);
+    }
+
+    // If no fit is found, request more memory, and then and place the block
+    if (block == NULL) {
+        // Always request at least chunksize, more while the heap keeps
+        // growing
+        extendsize = grow_size(arena, asize);
+        block = extend_heap(arena, extendsize);
+        // extend_heap returns an error
+        if (block == NULL) {
+            return bp;
+        }
+    }
+
+    // The block should be marked as free
+    dbg_assert(!get_alloc(block));
+
+    // Take the free block out of the explicit list
+    block_removal(arena, block);
+    char *fresh = arena->fresh;
+
+    // Mark block as allocated
+    size_t block_size = get_size(block);
+    write_block(arena, block, block_size, true, get_alloc_prev(block));
+
+    // Try to split the block if too large
+#ifdef TWO_ENDED
+    // Blocks past the linear classes go to the high end of their fit
+    if (asize > linear_class_max) {
+        block = split_block_high(arena, block, asize);
+    } else {
+        split_block(arena, block, asize);
+    }
+#else
+    split_block(arena, block, asize);
+#endif
+
+    bp = header_to_payload(block);
+    if (zero) {
+        clear_payload(block, size, fresh);
+    }
+
+    dbg_ensures(mm_checkheap(__LINE__));
+
+    return bp;
+}
+
+/**
+ * @brief Allocates a block for a `size`-byte request only if one of
+ * exactly its size is already free: an object of a slab with room, a
+ * block in a fast bin, or the first block of its single-size list. No
+ * block is split and the heap never grows, so blocks taken to fill a
+ * tcache ahead of time only hold memory that was free anyway.
+ * @param[in] arena the arena to allocate from, locked
+ * @param[in] size the requested payload size, below linear_class_max
+ * @return a payload pointer, or NULL if no such block is free
+ */
+static void *heap_reuse(arena_t *arena, size_t size) {
+    if (slab_fits(size) && arena->slabs[slab_class(size)] != NULL) {
+        return slab_malloc(arena, size);
+    }
+
+    size_t asize = max(round_up(size + wsize, dsize), min_block_size);
+    block_t *block = fast_get(arena, asize);
+    if (block != NULL) {
+        return header_to_payload(block);
+    }
+
+    size_t index = find_size_list(asize);
+    block = index >= ordered_class ? arena->tree_mins[index]
+                                   : arena->list_heads[index];
+    if (block == NULL) {
+        return NULL;
+    }
+    block_removal(arena, block);
+    write_block(arena, block, asize, true, get_alloc_prev(block));
+    split_block(arena, block, asize);
+    return header_to_payload(block);
+}
+
+/**
+ * @brief
+ *
+ * Allocates n blocks of size bytes in one pass. Each free block found, or
+ * the heap extension made when none fits, is carved into as many
+ * neighbouring blocks as it holds, so the size is adjusted and the lists
+ * searched once per run rather than once per block. Requests that go to
+ * a slab or a mapping gain nothing from a run and are made one by one.
+ *
+ * @param[in] arena the arena to allocate from
+ * @param[in] size size of each block
+ * @param[out] ptrs array receiving the payloads
+ * @param[in] n number of blocks wanted
+ * @return the number of blocks allocated, stored at the start of ptrs
+ * @pre the arena's lock is held
+ */
+static size_t heap_malloc_batch(arena_t *arena, size_t size, void **ptrs,
+                                size_t n) {
+    size_t done = 0;
+
+    if (size == 0) {
+        return 0;
+    }
+    if (slab_fits(size) ||
+        size >= __atomic_load_n(&map_threshold, __ATOMIC_RELAXED)) {
+        while (done < n &&
+               (ptrs[done] = heap_malloc(arena, size, false)) != NULL) {
+            done++;
+        }
+        return done;
+    }
+
+    size_t asize = max(round_up(size + wsize, dsize), min_block_size);
+    while (done < n) {
+        // prefer one block for the whole rest, then the best fit for a
+        // single block, and only then more heap
+        size_t want = n - done;
+        if (want > (SIZE_MAX >> 1) / asize) {
+            want = (SIZE_MAX >> 1) / asize;
+        }
+        block_t *block = find_fit(arena, asize * want);
+        if (block == NULL) {
+            block = find_fit(arena, asize);
+        }
+        if (block == NULL && fast_consolidate(arena)) {
+            continue;
+        }
+        if (block == NULL) {
+            block = extend_heap(arena, grow_size(arena, asize * want));
+        }
+        if (block == NULL && want > 1) {
+            // the heap may still grow by less than the whole run
+            block = extend_heap(arena, grow_size(arena, asize));
+        }
+        if (block == NULL) {
+            break;
+        }
+        block_removal(arena, block);
+
+        size_t avail = get_size(block);
+        size_t count = avail / asize < want ? avail / asize : want;
+        bool alloc_prev = get_alloc_prev(block);
+        for (size_t i = 1; i < count; i++) {
+            write_block(arena, block, asize, true, alloc_prev);
+            ptrs[done++] = header_to_payload(block);
+            block = find_next(block);
+            avail -= asize;
+            alloc_prev = true;
+        }
+        // the last block of the run takes the rest, minus what splits off
+        write_block(arena, block, avail, true, alloc_prev);
+        split_block(arena, block, asize);
+        ptrs[done++] = header_to_payload(block);
+    }
+
+    dbg_ensures(mm_checkheap(__LINE__));
+    return done;
+}
+
+/**
+ * @brief Lowers the slab demand estimate for a block being freed. A block
+ * of this size may have held a request of a slab class; blocks of sizes
+ * slab_fits rejects count too, so the estimate errs low.
+ * @param[in] arena the arena the block belongs to
+ * @param[in] size the size of the block
+ */
+static void slab_demand_drop(arena_t *arena, size_t size) {
+    if (size >= 2 * dsize && size <= slab_max + dsize) {
+        size_t index = size / dsize - 2;
+        if (arena->slab_demand[index] > 0) {
+            arena->slab_demand[index]--;
+        }
+    }
+}
+
+/**
+ * @brief
+ *
+ * Hands a block already marked free back to the arena: coalesces it with
+ * its neighbours, inserts the result into the lists, and gives a large
+ * free block at the top of the heap back to memlib.
+ *
+ * @param[in] arena the arena the block belongs to
+ * @param[in] block a free block in no list
+ */
+static void release_block(arena_t *arena, block_t *block) {
+    // Try to coalesce the block with its neighbors
+    block_t *result = coalesce_block(arena, block);
+
+    // Insert block into seglist
+    block_insertion(arena, result);
+
+    // A large free block at the top of the heap goes back to memlib
+    if (get_size(result) >= trim_threshold &&
+        find_next(result) == arena->epilogue) {
+        heap_trim(arena, trim_pad);
+    }
+}
+
+/**
+ * @brief
+ *
+ * frees the given memory that is no longer in use
+ *
+ * @param[in] arena the arena the block belongs to
+ * @param[in] bp block pointer that points to the block that needs to be freed
+ * @pre the arena's lock is held
+ */
+static void heap_free(arena_t *arena, void *bp) {
+    dbg_requires(mm_checkheap(__LINE__));
+    if (bp == NULL) {
+        return;
+    }
+
+    slab_t *slab = find_slab(bp);
+    if (slab != NULL) {
+        slab_free(arena, slab, bp);
+        dbg_ensures(mm_checkheap(__LINE__));
+        return;
+    }
+
+    block_t *block = payload_to_header(bp);
+    size_t size = get_size(block);
+
+    // The block should be marked as allocated
+    dbg_assert(get_alloc(block));
+
+    if (get_mapped(block)) {
+        map_free(block);
+        dbg_ensures(mm_checkheap(__LINE__));
+        return;
+    }
+
+    slab_demand_drop(arena, size);
+
+    // Small blocks wait in a fast bin, uncoalesced, for a request of the
+    // same size
+    if (size <= linear_class_max) {
+        fast_put(arena, block);
+        if (arena->fast_bytes > fast_limit) {
+            fast_consolidate(arena);
+        }
+        dbg_ensures(mm_checkheap(__LINE__));
+        return;
+    }
+
+    // Mark the block as free
+
+    write_block(arena, block, size, false, get_alloc_prev(block));
+    release_block(arena, block);
+
+    dbg_ensures(mm_checkheap(__LINE__));
+}
+
+/**
+ * @brief
+ *
+ * resizes an allocated block, keeping its contents. The block is resized
+ * in place whenever possible: shrinking splits off the tail, and growing
+ * absorbs a free successor, fresh heap space at the end of the heap, or a
+ * free predecessor (moving the payload down). Only when none of those fit
+ * is the block copied to a new allocation.
+ *
+ * @param[in] arena the arena the block belongs to
+ * @param[in] ptr points to the first block
+ * @param[in] size size of memory to be allocated
+ * @return pointer to the resized payload, or NULL on failure
+ * @pre the arena's lock is held
+ */
+static void *heap_realloc(arena_t *arena, void *ptr, size_t size) {
+    block_t *block = payload_to_header(ptr);
+    size_t copysize;
+    void *newptr;
+
+    // If size == 0, then free block and return NULL
+    if (size == 0) {
+        heap_free(arena, ptr);
+        return NULL;
+    }
+
+    // If ptr is NULL, then equivalent to malloc
+    if (ptr == NULL) {
+        return heap_malloc(arena, size, false);
+    }
+
+    dbg_requires(mm_checkheap(__LINE__));
+
+    // A slab object keeps its place while the request still fits it, and
+    // moves otherwise
+    slab_t *slab = find_slab(ptr);
+    if (slab != NULL) {
+        if (size <= slab->obj_size) {
+            return ptr;
+        }
+        newptr = heap_malloc(arena, size, false);
+        if (newptr == NULL) {
+            return NULL;
+        }
+        memcpy(newptr, ptr, slab->obj_size);
+        heap_free(arena, ptr);
+        return newptr;
+    }
+
+    // A mapped block is resized in place when it stays large and the pages
+    // above it are free, and moves otherwise
+    if (get_mapped(block)) {
+        if (size >= __atomic_load_n(&map_threshold, __ATOMIC_RELAXED) &&
+            map_resize(block, size)) {
+            return ptr;
+        }
+        newptr = heap_malloc(arena, size, false);
+        if (newptr == NULL) {
+            return NULL;
+        }
+        copysize = get_size(block) - dsize;
+        if (size < copysize) {
+            copysize = size;
+        }
+        memcpy(newptr, ptr, copysize);
+        map_free(block);
+        return newptr;
+    }
+
+    size_t asize = max(round_up(size + wsize, dsize), min_block_size);
+
+    if (asize <= get_size(block)) {
+        shrink_block(arena, block, asize);
+        dbg_ensures(mm_checkheap(__LINE__));
+        return ptr;
+    }
+
+    if (grow_block(arena, block, asize)) {
+        dbg_ensures(mm_checkheap(__LINE__));
+        return ptr;
+    }
+
+    block_t *merged = grow_block_down(arena, block, asize);
+    if (merged != NULL) {
+        dbg_ensures(mm_checkheap(__LINE__));
+        return header_to_payload(merged);
+    }
+
+    // Otherwise, proceed with reallocation
+    newptr = heap_malloc(arena, size, false);
+
+    // If malloc fails, the original block is left untouched
+    if (newptr == NULL) {
+        return NULL;
+    }
+
+    // Copy the old data
+    copysize = get_payload_size(block); // gets size of old payload
+    if (size < copysize) {
+        copysize = size;
+    }
+    memcpy(newptr, ptr, copysize);
+
+    // Free the old block
+    heap_free(arena, ptr);
+
+    return newptr;
+}
+
+/**
+ * @brief
+ *
+ * allocates a block whose payload starts on an `align`-byte boundary.
+ * Alignments up to dsize are what malloc gives anyway; larger ones are
+ * placed in the heap by place_aligned, which frees the slack in front of
+ * the payload as a block of its own. Slabs and mappings only guarantee
+ * dsize alignment, so they are not used for larger ones.
+ *
+ * @param[in] arena the arena to allocate from
+ * @param[in] align required payload alignment, a power of two
+ * @param[in] size size that wants to be alloced onto heap
+ * @return pointer to the payload, or NULL on failure
+ * @pre the arena's lock is held
+ */
+static void *heap_memalign(arena_t *arena, size_t align, size_t size) {
+    if (align <= dsize) {
+        return heap_malloc(arena, size, false);
+    }
+
+    dbg_requires(mm_checkheap(__LINE__));
+
+    // Ignore spurious and hopelessly large requests
+    if (size == 0 || size > (SIZE_MAX >> 1) - align) {
+        return NULL;
+    }
+
+    size_t asize = max(round_up(size + wsize, dsize), min_block_size);
+    block_t *block = place_aligned(arena, asize, align);
+    if (block == NULL) {
+        return NULL;
+    }
+
+    dbg_ensures(mm_checkheap(__LINE__));
+    return header_to_payload(block);
+}
+
+/*
+ * ---------------------------------------------------------------------------
+ *                        THREAD SUPPORT
+ *
+ * With THREAD_SAFE defined, every heap_* routine runs under the lock of
+ * the arena it works on. Each thread is assigned the arena with the fewest
+ * threads the first time it calls in, allocates from that arena from then
+ * on, and frees every block back to the arena recorded in its header.
+ *
+ * Each thread also keeps a small cache (tcache) of allocated-but-unused
+ * blocks for every block size up to linear_class_max, and of objects for
+ * every slab class. Blocks sit in the tcache still marked allocated,
+ * linked through their first payload word, so neither pushing nor popping
+ * touches shared state or takes a lock.
+ * A lock is only taken to refill an empty bin or flush a full one. A bin
+ * is only refilled with blocks of its size that are already free, so
+ * caching never grows the heap, and the cache is bounded in bytes, per bin
+ * and in all, so it never holds much of a small heap.
+ *
+ * Without THREAD_SAFE there is a single arena, the lock and tcache hooks
+ * are empty, and the public entry points behave exactly like the
+ * single-threaded heap_* routines.
+ * ---------------------------------------------------------------------------
+ */
+
+#ifdef THREAD_SAFE
+
+/**
+ * @brief Number of tcache bins: one per block size up to 256 bytes, then
+ * one per slab class
+ */
+#define TCACHE_BINS 24
+
+/**
+ * @brief Most bytes a thread may hold in one tcache bin; a refill or flush
+ * moves half of that
+ */
+static const size_t tcache_bin_bytes = 1 << 9;
+
+/**
+ * @brief Most bytes a thread may hold in its whole tcache; a free that
+ * would go past it goes to the heap instead
+ */
+static const size_t tcache_bytes = 1 << 10;
+
+/** @brief A thread's cache of free blocks, one LIFO list per block size */
+typedef struct {
+    void *heads[TCACHE_BINS];
+    size_t counts[TCACHE_BINS];
+    /** @brief Total size of the cached blocks (see tcache_block_size) */
+    size_t bytes;
+    /** @brief Value of heap_epoch the cached blocks were allocated under */
+    word_t epoch;
+    /** @brief True once the thread-exit flush has been registered */
+    bool registered;
+    /** @brief The arena the thread allocates from */
+    arena_t *arena;
+} tcache_t;
+
+/** @brief Bumped by mm_init so tcaches drop blocks of a discarded heap */
+static word_t heap_epoch = 0;
+
+/** @brief The calling thread's block cache */
+static _Thread_local tcache_t tcache;
+
+/** @brief Key whose destructor flushes a tcache when its thread exits */
+static pthread_key_t tcache_key;
+
+/** @brief Guards the one-time creation of tcache_key */
+static pthread_once_t tcache_key_once = PTHREAD_ONCE_INIT;
+
+/** @brief Guards the one-time setup of the arena locks */
+static pthread_once_t heap_once = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief Sets up the arena locks, and the heap itself if mm_init has not
+ * been called yet.
+ */
+static void heap_setup(void) {
+    for (size_t i = 0; i < NUM_ARENAS; i++) {
+        pthread_mutex_init(&arenas[i].lock, NULL);
+    }
+    if (heap_start == NULL) {
+        mm_init();
+    }
+}
+
+/**
+ * @brief Makes sure the arena locks and the heap are set up before the
+ * first allocation, however many threads make it at once.
+ */
+static void heap_ready(void) {
+    pthread_once(&heap_once, heap_setup);
+}
+
+/**
+ * @brief Forgets every cached block; called when mm_init starts a new heap,
+ * since the blocks of the old heap no longer exist.
+ */
+static void tcache_invalidate(void) {
+    heap_epoch++;
+}
+
+/**
+ * @brief Returns the size counted for each block of a tcache bin: its
+ * block size, or the object size of a slab class.
+ * @param[in] index the bin
+ * @return the bytes one cached block of the bin counts for
+ */
+static size_t tcache_block_size(size_t index) {
+    size_t step = index < linear_classes ? index : index - linear_classes;
+    return (step + 1) * dsize;
+}
+
+/**
+ * @brief Returns how many blocks one tcache bin may hold, which keeps the
+ * bin within tcache_bin_bytes.
+ * @param[in] index the bin
+ * @return the bin's capacity, at least 2
+ */
+static size_t tcache_capacity(size_t index) {
+    return max(tcache_bin_bytes / tcache_block_size(index), 2);
+}
+
+/**
+ * @brief Returns up to `n` blocks of one tcache bin to the heap.
+ * @param[in] tc the tcache to flush
+ * @param[in] index the bin to flush
+ * @param[in] n the number of blocks to return
+ */
+static void tcache_flush(tcache_t *tc, size_t index, size_t n) {
+    // cached blocks may come from any arena; keep the lock across runs of
+    // blocks from the same one
+    arena_t *locked = NULL;
+    while (n > 0 && tc->counts[index] > 0) {
+        void *bp = tc->heads[index];
+        tc->heads[index] = *(void **)bp;
+        tc->counts[index]--;
+        tc->bytes -= tcache_block_size(index);
+
+        arena_t *arena = payload_arena(bp);
+        if (arena != locked) {
+            if (locked != NULL) {
+                unlock_arena(locked);
+            }
+            lock_arena(arena);
+            locked = arena;
+        }
+        heap_free(arena, bp);
+        n--;
+    }
+    if (locked != NULL) {
+        unlock_arena(locked);
+    }
+}
+
+/**
+ * @brief Returns every cached block of the exiting thread to the heap and
+ * takes the thread off its arena.
+ * @param[in] arg the exiting thread's tcache
+ */
+static void tcache_destroy(void *arg) {
+    tcache_t *tc = (tcache_t *)arg;
+    if (tc->epoch == heap_epoch) {
+        for (size_t i = 0; i < TCACHE_BINS; i++) {
+            tcache_flush(tc, i, tc->counts[i]);
+        }
+    }
+
+    lock_heap();
+    tc->arena->threads--;
+    unlock_heap();
+}
+
+/**
+ * @brief Picks the arena with the fewest live threads for a new thread.
+ * @return the arena the thread should allocate from
+ */
+static arena_t *arena_assign(void) {
+    lock_heap();
+    arena_t *best = &arenas[0];
+    for (size_t i = 1; i < NUM_ARENAS; i++) {
+        if (arenas[i].threads < best->threads) {
+            best = &arenas[i];
+        }
+    }
+    best->threads++;
+    unlock_heap();
+    return best;
+}
+
+/**
+ * @brief Creates the key used to flush tcaches at thread exit.
+ */
+static void tcache_make_key(void) {
+    pthread_key_create(&tcache_key, tcache_destroy);
+}
+
+/**
+ * @brief Returns the calling thread's tcache, emptying it first if it
+ * still holds blocks of a heap that mm_init has since replaced.
+ * @return the calling thread's tcache
+ */
+static tcache_t *tcache_self(void) {
+    tcache_t *tc = &tcache;
+    if (tc->epoch != heap_epoch) {
+        for (size_t i = 0; i < TCACHE_BINS; i++) {
+            tc->heads[i] = NULL;
+            tc->counts[i] = 0;
+        }
+        tc->bytes = 0;
+        tc->epoch = heap_epoch;
+    }
+    if (!tc->registered) {
+        pthread_once(&tcache_key_once, tcache_make_key);
+        pthread_setspecific(tcache_key, tc);
+        tc->arena = arena_assign();
+        tc->registered = true;
+    }
+    return tc;
+}
+
+/**
+ * @brief Returns the arena the calling thread allocates from.
+ * @return the calling thread's arena
+ */
+static arena_t *thread_arena(void) {
+    return tcache_self()->arena;
+}
+
+/**
+ * @brief Takes a block for a `size`-byte request from the calling thread's
+ * tcache. An empty bin is refilled under one lock with free blocks of its
+ * size (see heap_reuse); if there are none, the request itself is served
+ * from the heap under that lock.
+ * @param[in] size the requested payload size
+ * @return a payload pointer, or NULL if the request is not cached and the
+ * heap could not serve it
+ */
+static void *tcache_get(size_t size) {
+    if (size == 0 || size > linear_class_max - wsize) {
+        return NULL;
+    }
+    size_t index;
+    if (slab_fits(size)) {
+        index = linear_classes + slab_class(size);
+    } else {
+        size_t asize = max(round_up(size + wsize, dsize), min_block_size);
+        index = find_size_list(asize);
+    }
+    tcache_t *tc = tcache_self();
+
+    if (tc->counts[index] == 0) {
+        size_t batch = tcache_capacity(index) / 2;
+        size_t room = (tcache_bytes - tc->bytes) / tcache_block_size(index);
+        batch = batch < room ? batch : room;
+        lock_arena(tc->arena);
+        while (tc->counts[index] < batch) {
+            void *bp = heap_reuse(tc->arena, size);
+            if (bp == NULL) {
+                break;
+            }
+            *(void **)bp = tc->heads[index];
+            tc->heads[index] = bp;
+            tc->counts[index]++;
+            tc->bytes += tcache_block_size(index);
+        }
+        if (tc->counts[index] == 0) {
+            void *bp = heap_malloc(tc->arena, size, false);
+            unlock_arena(tc->arena);
+            return bp;
+        }
+        unlock_arena(tc->arena);
+    }
+
+    void *bp = tc->heads[index];
+    tc->heads[index] = *(void **)bp;
+    tc->counts[index]--;
+    tc->bytes -= tcache_block_size(index);
+    return bp;
+}
+
+/**
+ * @brief Parks a freed block in the calling thread's tcache, first
+ * flushing part of the bin back to the heap if it is full. A block that
+ * would take the whole cache past tcache_bytes is not cached.
+ * @param[in] bp the payload being freed
+ * @return true if the block was cached, false if it must go to the heap
+ */
+static bool tcache_put(void *bp) {
+    size_t index;
+    slab_t *slab = find_slab(bp);
+    if (slab != NULL) {
+        index = linear_classes + slab_class(slab->obj_size);
+    } else {
+        size_t size = extract_size(read_header(payload_to_header(bp)));
+        if (size > linear_class_max) {
+            return false;
+        }
+        index = find_size_list(size);
+    }
+    tcache_t *tc = tcache_self();
+
+    size_t capacity = tcache_capacity(index);
+    if (tc->counts[index] >= capacity) {
+        tcache_flush(tc, index, capacity / 2);
+    }
+    if (tc->bytes + tcache_block_size(index) > tcache_bytes) {
+        return false;
+    }
+    *(void **)bp = tc->heads[index];
+    tc->heads[index] = bp;
+    tc->counts[index]++;
+    tc->bytes += tcache_block_size(index);
+    return true;
+}
+
+#else
+
+/**
+ * @brief Sets the heap up if mm_init has not been called yet.
+ */
+static void heap_ready(void) {
+    if (heap_start == NULL) {
+        mm_init();
+    }
+}
+
+/**
+ * @brief Returns the arena the calling thread allocates from, which is
+ * the only one without THREAD_SAFE.
+ * @return the single arena
+ */
+static arena_t *thread_arena(void) {
+    return &arenas[0];
+}
+
+/**
+ * @brief Forgets every cached block (there is no tcache without
+ * THREAD_SAFE).
+ */
+static void tcache_invalidate(void) {
+}
 
-        // printf("false line 774 free links %zu free blocks %zu", freelinks,
-        // freeblocks);
-        return false;
-    }
+/**
+ * @brief Takes a block from the tcache (there is none without
+ * THREAD_SAFE).
+ * @param[in] size the requested payload size
+ * @return NULL
+ */
+static void *tcache_get(size_t size) {
+    return NULL;
+}
 
-    return true;
+/**
+ * @brief Parks a freed block in the tcache (there is none without
+ * THREAD_SAFE).
+ * @param[in] bp the payload being freed
+ * @return false
+ */
+static bool tcache_put(void *bp) {
+    return false;
 }
 
+#endif /* def THREAD_SAFE */
+
 /**
  * @brief
  *
@@ -945,192 +3964,160 @@ bool mm_checkheap(int line) {
  * @return true if it was successful, false otherwise
  */
 bool mm_init(void) {
-    // Create the initial empty heap
-    word_t *start = (word_t *)(mem_sbrk(2 * wsize));
-
-    for (size_t i = 0; i < 15; i++) {
-        list_heads[i] = NULL;
+    for (size_t i = 0; i < NUM_ARENAS; i++) {
+        arena_t *arena = &arenas[i];
+        for (size_t j = 0; j < NUM_LISTS; j++) {
+            arena->list_heads[j] = NULL;
+            arena->tree_mins[j] = NULL;
+            arena->rovers[j] = NULL;
+            arena->list_counts[j] = 0;
+            arena->list_hits[j] = 0;
+        }
+        arena->list_bitmap = 0;
+        for (size_t j = 0; j < FAST_BINS; j++) {
+            arena->fast_heads[j] = NULL;
+        }
+        arena->fast_bytes = 0;
+        arena->epilogue = NULL;
+        arena->wild = NULL;
+        arena->grow_streak = 0;
+        arena->fresh = NULL;
+        arena->check_logged = 0;
+        arena->check_lists = 0;
+        for (size_t j = 0; j < SLAB_CLASSES; j++) {
+            arena->slabs[j] = NULL;
+            arena->slab_demand[j] = 0;
+        }
     }
-
-    if (start == (void *)-1) {
-        return false;
+    for (size_t i = 0; i < SLAB_PAGE_WORDS; i++) {
+        slab_pages[i] = 0;
+    }
+    heap_start = NULL;
+    tcache_invalidate();
+
+    // Classes above the single-size buckets are always trees
+    size_t threshold = __atomic_load_n(&ordered_threshold, __ATOMIC_RELAXED);
+    ordered_class = linear_classes;
+    if (threshold <= linear_class_max) {
+        threshold = max(round_up(threshold, dsize), tree_block_min);
+        ordered_class = find_size_list(threshold);
     }
 
-    start[0] = pack(0, true, false, false); // Heap prologue (block footer)
-    start[1] = pack(0, true, true, false);  // Heap epilogue (block header)
-
-    // Heap starts with first "block header", currently the epilogue
-    heap_start = (block_t *)&(start[1]);
-
-    // // printf("\n\ninit");
+    check_armed = false;
+    check_calls = 0;
+    stats = (mm_stats_t){0};
 
-    // Extend the empty heap with a free block of chunksize bytes
-    if (extend_heap(chunksize) == NULL) {
+    // Create the initial heap: the first segment of arena 0, holding a
+    // free block of chunksize bytes between the prologue and epilogue
+    block_t *block = extend_heap(&arenas[0], chunksize);
+    if (block == NULL) {
         return false;
     }
 
+    // Heap starts with first "block header"
+    heap_start = block;
+    slab_base = (uintptr_t)mem_heap_lo();
+
     return true;
 }
 
 /**
  * @brief
  *
- * allocates the amount of memory given onto the heap
- * requires the size to be non negative
+ * allocates the amount of memory given onto the heap, taking small
+ * blocks from the calling thread's tcache when there is one
+ *
  * @param[in] size size that wants to be alloced onto heap
- * @return no return
+ * @return pointer to the payload, or NULL on failure
  */
 void *malloc(size_t size) {
+    heap_ready();
 
-    dbg_requires(mm_checkheap(__LINE__));
-
-    size_t asize;      // Adjusted block size
-    size_t extendsize; // Amount to extend heap if no fit is found
-    block_t *block;
-    void *bp = NULL;
-
-    // Initialize heap if it isn't initialized
-    if (heap_start == NULL) {
-        mm_init();
-    }
-
-    // Ignore spurious request
-    if (size == 0) {
-        dbg_ensures(mm_checkheap(__LINE__));
-        // // printf("\nmalloc END\n");
+    void *bp = tcache_get(size);
+    if (bp != NULL) {
+        stat_alloc(bp);
         return bp;
     }
 
-    // Adjust block size to include overhead and to meet alignment requirements
-    asize = max(round_up(size + wsize, dsize), min_block_size);
-
-    // Search the free list for a fit
-    block = find_fit(asize);
-
-    // If no fit is found, request more memory, and then and place the block
-    if (block == NULL) {
-        // Always request at least chunksize
-        extendsize = max(asize, chunksize);
-        block = extend_heap(extendsize);
-        // extend_heap returns an error
-        if (block == NULL) {
-            return bp;
-        }
-    }
-
-    // The block should be marked as free
-    dbg_assert(!get_alloc(block));
-
-    // Take the free block out of the explicit list
-    block_removal(block);
-
-    // Mark block as allocated
-    size_t block_size = get_size(block);
-    write_block(block, block_size, true, get_alloc_prev(block));
-
-    // Try to split the block if too large
-    split_block(block, asize);
-
-    bp = header_to_payload(block);
-
-    block_t *ne = find_next(block);
-    if (get_alloc(ne) && get_size(ne) == 0) {
-        write_epilogue(ne, true);
-    }
-
-    dbg_ensures(mm_checkheap(__LINE__));
-
+    arena_t *arena = thread_arena();
+    lock_arena(arena);
+    bp = heap_malloc(arena, size, false);
+    unlock_arena(arena);
+    stat_alloc(bp);
     return bp;
 }
 
 /**
  * @brief
  *
- * frees the given memory that is no longer in use
+ * frees the given memory that is no longer in use, parking small blocks
+ * in the calling thread's tcache when there is one and otherwise handing
+ * them back to the arena that owns them
  *
  * @param[in] bp block pointer that points to the block that needs to be freed
  */
 void free(void *bp) {
-    dbg_requires(mm_checkheap(__LINE__));
     if (bp == NULL) {
         return;
     }
+    stat_free(bp);
+    if (tcache_put(bp)) {
+        return;
+    }
 
-    block_t *block = payload_to_header(bp);
-    size_t size = get_size(block);
-
-    // The block should be marked as allocated
-    dbg_assert(get_alloc(block));
-
-    // Mark the block as free
-
-    write_block(block, size, false, get_alloc_prev(block));
-
-    // Try to coalesce the block with its neighbors
-    block_t *result = coalesce_block(block);
-
-    // Insert block into seglist
-    block_insertion(result);
-
-    dbg_ensures(mm_checkheap(__LINE__));
+    arena_t *arena = payload_arena(bp);
+    lock_arena(arena);
+    heap_free(arena, bp);
+    unlock_arena(arena);
 }
 
 /**
  * @brief
  *
- * allocates the memory from the start
+ * resizes an allocated block, keeping its contents (see heap_realloc).
+ * The block stays in the arena that owns it, and the pointer is returned
+ * as is whenever the new size fits the usable size.
  *
  * @param[in] ptr points to the first block
  * @param[in] size size of memory to be allocated
- * @return
+ * @return pointer to the resized payload, or NULL on failure
  */
 void *realloc(void *ptr, size_t size) {
-    block_t *block = payload_to_header(ptr);
-    size_t copysize;
-    void *newptr;
-
-    // If size == 0, then free block and return NULL
-    if (size == 0) {
-        free(ptr);
-        return NULL;
-    }
-
-    // If ptr is NULL, then equivalent to malloc
+    stat_add(&stats.reallocs, 1);
     if (ptr == NULL) {
         return malloc(size);
     }
 
-    // Otherwise, proceed with reallocation
-    newptr = malloc(size);
-
-    // If malloc fails, the original block is left untouched
-    if (newptr == NULL) {
-        return NULL;
+    // A request the block already holds keeps its pointer without taking
+    // the lock, unless the slack left over is worth handing back
+    size_t usable = usable_size(ptr);
+    if (size != 0 && size <= usable && usable - size < min_block_size) {
+        return ptr;
     }
 
-    // Copy the old data
-    copysize = get_payload_size(block); // gets size of old payload
-    if (size < copysize) {
-        copysize = size;
+    if (size == 0) {
+        stat_free(ptr);
+    }
+    arena_t *arena = payload_arena(ptr);
+    lock_arena(arena);
+    void *newptr = heap_realloc(arena, ptr, size);
+    unlock_arena(arena);
+    if (newptr != NULL) {
+        stat_add(&stats.bytes_in_use, usable_size(newptr) - usable);
     }
-    memcpy(newptr, ptr, copysize);
-
-    // Free the old block
-    free(ptr);
-
     return newptr;
 }
 
 /**
  * @brief
  *
- * <What does this function do?>
- * Tries to allocate memory and returns heap
- * if successful and returns null if unsuccessful
+ * Allocates a zeroed array. It skips the tcache, whose blocks are never
+ * fresh, and clears only the bytes of the block that might not already
+ * read as zero, so memory that memlib hands out fresh is not written.
  *
  * @param[in] elements the number of elements needed
  * @param[in] size the size each element is
- * @return
+ * @return pointer to the payload, or NULL on failure or overflow
  */
 void *calloc(size_t elements, size_t size) {
     void *bp;
@@ -1144,17 +4131,368 @@ void *calloc(size_t elements, size_t size) {
         return NULL;
     }
 
-    bp = malloc(asize);
-    if (bp == NULL) {
-        return NULL;
+    heap_ready();
+    arena_t *arena = thread_arena();
+    lock_arena(arena);
+    bp = heap_malloc(arena, asize, true);
+    unlock_arena(arena);
+    stat_alloc(bp);
+    return bp;
+}
+
+/**
+ * @brief
+ *
+ * Returns the number of bytes the caller may use at ptr, which is at least
+ * the size it asked for and includes slack the allocator could not split
+ * off. Growing a block within it never moves the block.
+ *
+ * @param[in] ptr a payload handed out by malloc, or NULL
+ * @return the usable size in bytes, or 0 for NULL
+ */
+size_t mm_usable_size(void *ptr) {
+    if (ptr == NULL) {
+        return 0;
     }
+    return usable_size(ptr);
+}
 
-    // Initialize all bits to 0
-    memset(bp, 0, asize);
+#ifndef DRIVER
+/**
+ * @brief
+ *
+ * glibc's name for mm_usable_size, for programs run against this
+ * allocator.
+ *
+ * @param[in] ptr a payload handed out by malloc, or NULL
+ * @return the usable size in bytes, or 0 for NULL
+ */
+size_t malloc_usable_size(void *ptr) {
+    return mm_usable_size(ptr);
+}
+#endif
+
+/**
+ * @brief
+ *
+ * allocates a block whose payload is a multiple of alignment
+ * (see heap_memalign). Small alignments may take a block from the tcache.
+ *
+ * @param[in] alignment the payload alignment, a power of two
+ * @param[in] size size that wants to be alloced onto heap
+ * @return pointer to the payload, or NULL on failure or a bad alignment
+ */
+void *memalign(size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (alignment <= dsize) {
+        return malloc(size);
+    }
 
+    heap_ready();
+    arena_t *arena = thread_arena();
+    lock_arena(arena);
+    void *bp = heap_memalign(arena, alignment, size);
+    unlock_arena(arena);
+    stat_alloc(bp);
+    if (bp == NULL && size != 0) {
+        errno = ENOMEM;
+    }
     return bp;
 }
 
+/**
+ * @brief
+ *
+ * allocates a block whose payload is a multiple of alignment, storing it
+ * in *memptr. A zero size stores NULL and succeeds.
+ *
+ * @param[out] memptr receives the payload; untouched on failure
+ * @param[in] alignment the payload alignment, a power of two multiple of
+ *                      sizeof(void *)
+ * @param[in] size size that wants to be alloced onto heap
+ * @return 0, EINVAL for a bad alignment, or ENOMEM
+ */
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+    if (alignment == 0 || alignment % sizeof(void *) != 0 ||
+        (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    if (size == 0) {
+        *memptr = NULL;
+        return 0;
+    }
+
+    int saved = errno;
+    void *bp = memalign(alignment, size);
+    errno = saved;
+    if (bp == NULL) {
+        return ENOMEM;
+    }
+    *memptr = bp;
+    return 0;
+}
+
+/**
+ * @brief
+ *
+ * allocates a block whose payload is a multiple of alignment, as C11
+ * defines it; any size is accepted, not just multiples of alignment.
+ *
+ * @param[in] alignment the payload alignment, a power of two
+ * @param[in] size size that wants to be alloced onto heap
+ * @return pointer to the payload, or NULL on failure or a bad alignment
+ */
+void *aligned_alloc(size_t alignment, size_t size) {
+    return memalign(alignment, size);
+}
+
+/**
+ * @brief
+ *
+ * Allocates n blocks of the same size at once, from the calling thread's
+ * arena, carving neighbouring blocks out of one free block where it can.
+ *
+ * @param[in] size size of each block
+ * @param[out] ptrs array receiving the payloads
+ * @param[in] n number of blocks wanted
+ * @return the number of blocks allocated, stored at the start of ptrs;
+ *         less than n only if the heap cannot grow or size is 0
+ */
+size_t mm_malloc_batch(size_t size, void **ptrs, size_t n) {
+    heap_ready();
+
+    arena_t *arena = thread_arena();
+    lock_arena(arena);
+    size_t done = heap_malloc_batch(arena, size, ptrs, n);
+    unlock_arena(arena);
+    for (size_t i = 0; stats_enabled && i < done; i++) {
+        stat_alloc(ptrs[i]);
+    }
+    return done;
+}
+
+/**
+ * @brief
+ *
+ * Frees an array of payloads in one sweep. The array is sorted by address
+ * first, so blocks freed next to each other are merged into a single free
+ * block that is only coalesced with its outer neighbours and inserted
+ * into the lists once. Slab objects and mapped blocks are freed one by
+ * one, and the tcache is bypassed.
+ *
+ * @param[in,out] ptrs the payloads to free, NULL entries included; left
+ *                     sorted by address
+ * @param[in] n number of entries in ptrs
+ */
+void mm_free_batch(void **ptrs, size_t n) {
+    qsort(ptrs, n, sizeof(*ptrs), address_order);
+
+    arena_t *locked = NULL;
+    block_t *run = NULL; // free block being grown, in no list yet
+    for (size_t i = 0; i < n; i++) {
+        void *bp = ptrs[i];
+        if (bp == NULL) {
+            continue;
+        }
+        stat_free(bp);
+
+        slab_t *slab = find_slab(bp);
+        block_t *block = payload_to_header(bp);
+        arena_t *arena = slab != NULL ? slab->arena : arena_of(block);
+        bool single = slab != NULL || get_mapped(block);
+        if (run != NULL &&
+            (arena != locked || single || find_next(run) != block)) {
+            release_block(locked, run);
+            run = NULL;
+        }
+        if (arena != locked) {
+            if (locked != NULL) {
+                unlock_arena(locked);
+            }
+            lock_arena(arena);
+            locked = arena;
+        }
+        if (single) {
+            heap_free(arena, bp);
+            continue;
+        }
+
+        dbg_assert(get_alloc(block));
+        size_t size = get_size(block);
+        slab_demand_drop(arena, size);
+        if (run == NULL) {
+            write_block(arena, block, size, false, get_alloc_prev(block));
+            run = block;
+        } else {
+            write_block(arena, run, get_size(run) + size, false,
+                        get_alloc_prev(run));
+        }
+    }
+    if (run != NULL) {
+        release_block(locked, run);
+    }
+    if (locked != NULL) {
+        dbg_ensures(mm_checkheap(__LINE__));
+        unlock_arena(locked);
+    }
+}
+
+/**
+ * @brief
+ *
+ * Sets the size from which requests are served from a mapping of their
+ * own. Blocks already handed out keep their place; a mapped block that is
+ * reallocated below the threshold moves into the heap.
+ *
+ * @param[in] threshold smallest request to map, SIZE_MAX to map none
+ * @return the previous threshold
+ */
+size_t mm_set_map_threshold(size_t threshold) {
+    return __atomic_exchange_n(&map_threshold, threshold, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief
+ *
+ * Chooses how the heap grows when no free block fits a request (see
+ * grow_size). The change applies from the next time the heap grows.
+ *
+ * @param[in] policy the growth policy to use
+ * @return the previous policy
+ */
+mm_growth_t mm_set_growth(mm_growth_t policy) {
+    return __atomic_exchange_n(&growth, policy, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief
+ *
+ * Sets the smallest free block kept in address order. Every class above
+ * linear_class_max is a size tree already; a lower threshold turns the
+ * single-size buckets from it up into trees too, so a fit comes from the
+ * lowest address of its size instead of the most recently freed block.
+ * The free lists are laid out by mm_init, so the change applies from the
+ * next call of mm_init.
+ *
+ * @param[in] threshold smallest block to keep in address order, SIZE_MAX
+ * for the size trees alone
+ * @return the previous threshold
+ */
+size_t mm_set_ordered_threshold(size_t threshold) {
+    return __atomic_exchange_n(&ordered_threshold, threshold,
+                               __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief
+ *
+ * Gives free memory at the top of the heap back to memlib, keeping `pad`
+ * bytes free there. Frees already do this on their own once the free
+ * space at the top reaches trim_threshold.
+ *
+ * @param[in] pad free bytes to keep at the top of the heap
+ * @return true if any memory was given back
+ */
+bool mm_trim(size_t pad) {
+    heap_ready();
+    bool trimmed = false;
+    for (size_t a = 0; a < NUM_ARENAS; a++) {
+        arena_t *arena = &arenas[a];
+        lock_arena(arena);
+        fast_consolidate(arena);
+        if (heap_trim(arena, pad)) {
+            trimmed = true;
+        }
+        unlock_arena(arena);
+    }
+    return trimmed;
+}
+
+/**
+ * @brief Adds up the sizes of the free blocks in a subtree of a size tree.
+ * @param[in] node the root of the subtree, or NULL
+ * @return the free bytes the subtree holds
+ */
+static size_t tree_bytes(block_t *node) {
+    if (node == NULL) {
+        return 0;
+    }
+    return get_size(node) + tree_bytes(node->left) + tree_bytes(node->right);
+}
+
+/**
+ * @brief Adds up the sizes of the free blocks in one of an arena's lists.
+ * @param[in] arena the arena owning the list
+ * @param[in] index the list
+ * @return the free bytes the list holds
+ */
+static size_t list_bytes(arena_t *arena, size_t index) {
+    if (index < ordered_class) {
+        size_t bytes = 0;
+        for (block_t *b = arena->list_heads[index]; b != NULL; b = b->next) {
+            bytes += get_size(b);
+        }
+        return bytes;
+    }
+    return tree_bytes(arena->list_heads[index]);
+}
+
+/**
+ * @brief
+ *
+ * Copies the per-list counters (free blocks and bytes held, find_fit
+ * hits) into `stats`, one entry per segregated list, so that callers such
+ * as mdriver can see how searches are spread over the lists. The counters
+ * are summed over all arenas; the wilderness and the fast bins are in no
+ * list, so they are not counted.
+ *
+ * @param[out] stats array to fill in, may be NULL when n is 0
+ * @param[in] n number of entries `stats` can hold
+ * @return the number of segregated lists the allocator maintains
+ */
+size_t mm_bin_stats(mm_bin_stats_t *stats, size_t n) {
+    heap_ready();
+    for (size_t i = 0; i < n && i < NUM_LISTS; i++) {
+        stats[i].free_blocks = 0;
+        stats[i].free_bytes = 0;
+        stats[i].fit_hits = 0;
+    }
+    for (size_t a = 0; a < NUM_ARENAS; a++) {
+        arena_t *arena = &arenas[a];
+        lock_arena(arena);
+        for (size_t i = 0; i < n && i < NUM_LISTS; i++) {
+            stats[i].free_blocks += arena->list_counts[i];
+            stats[i].free_bytes += list_bytes(arena, i);
+            stats[i].fit_hits += arena->list_hits[i];
+        }
+        unlock_arena(arena);
+    }
+    return NUM_LISTS;
+}
+
+/**
+ * @brief
+ *
+ * Copies the allocator's counters into `out`. The heap size is always
+ * reported; the event counters only in a build with MM_STATS, and are
+ * zero otherwise. While other threads allocate, the counters are read
+ * one at a time and may not agree with each other exactly.
+ *
+ * @param[out] out the counters
+ * @return true if the event counters are kept, false otherwise
+ */
+bool mm_stats(mm_stats_t *out) {
+    heap_ready();
+    *out = stats;
+    lock_heap();
+    out->heap_size = mem_heapsize();
+    unlock_heap();
+    return stats_enabled;
+}
+
 /*
  *****************************************************************************
  * Do not delete the following super-secret(tm) lines!                       *
@@ -16,6 +16,9 @@ extern void *mm_malloc(size_t size);
 extern void mm_free(void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
 extern void *mm_calloc(size_t nmemb, size_t size);
+extern void *mm_memalign(size_t alignment, size_t size);
+extern int mm_posix_memalign(void **memptr, size_t alignment, size_t size);
+extern void *mm_aligned_alloc(size_t alignment, size_t size);
 
 #else
 
@@ -59,6 +62,48 @@ extern void *realloc(void *ptr, size_t size);
  * @return A pointer to the first element of the array.
  */
 extern void *calloc(size_t nmemb, size_t size);
+
+/**
+ * @brief  Allocate at least `size` bytes aligned to `alignment` bytes.
+ *
+ * @param[in] alignment  The alignment of the payload, a power of two.
+ * @param[in] size  The minimum size of bytes to allocate.
+ *
+ * @return  A pointer to the beginning of the allocated bytes, or NULL
+ *          with errno set to EINVAL for a bad alignment or ENOMEM.
+ */
+extern void *memalign(size_t alignment, size_t size);
+
+/**
+ * @brief  Allocate at least `size` bytes aligned to `alignment` bytes.
+ *
+ * @param[out] memptr  Receives the pointer to the allocated bytes.
+ * @param[in] alignment  The alignment of the payload, a power of two
+ *                       multiple of sizeof(void *).
+ * @param[in] size  The minimum size of bytes to allocate.
+ *
+ * @return  0 on success, EINVAL for a bad alignment, or ENOMEM.
+ */
+extern int posix_memalign(void **memptr, size_t alignment, size_t size);
+
+/**
+ * @brief  Allocate at least `size` bytes aligned to `alignment` bytes.
+ *
+ * @param[in] alignment  The alignment of the payload, a power of two.
+ * @param[in] size  The minimum size of bytes to allocate.
+ *
+ * @return  A pointer to the beginning of the allocated bytes.
+ */
+extern void *aligned_alloc(size_t alignment, size_t size);
+
+/**
+ * @brief  Report how many bytes of an allocated block may be used.
+ *
+ * @param[in] ptr  A pointer to the beginning of the allocated payload.
+ *
+ * @return  The usable size, the same as mm_usable_size.
+ */
+extern size_t malloc_usable_size(void *ptr);
 #endif
 
 /**
@@ -78,4 +123,152 @@ extern bool mm_init(void);
  */
 extern bool mm_checkheap(int line);
 
+/**
+ * @brief  Report how many bytes of an allocated block may be used.
+ *
+ * This is at least the size requested, and includes any slack the
+ * allocator kept in the block. realloc to a size within it returns the
+ * same pointer.
+ *
+ * @param[in] ptr  A pointer to the beginning of the allocated payload,
+ *                 or NULL.
+ *
+ * @return  The usable size in bytes, or 0 for NULL.
+ */
+extern size_t mm_usable_size(void *ptr);
+
+/**
+ * @brief  Set the size from which requests get a mapping of their own.
+ *
+ * Requests of at least `threshold` bytes are served from a page-aligned
+ * region outside the heap, which is released as soon as it is freed.
+ *
+ * @param[in] threshold  The smallest request to map, or SIZE_MAX to
+ *                       keep every request in the heap.
+ *
+ * @return  The previous threshold.
+ */
+extern size_t mm_set_map_threshold(size_t threshold);
+
+/** @brief How the heap grows when no free block fits a request */
+typedef enum {
+    MM_GROW_FIXED,   /* by a fixed chunk, or the request if larger */
+    MM_GROW_ADAPTIVE /* by larger steps while it keeps having to grow */
+} mm_growth_t;
+
+/**
+ * @brief  Choose how the heap grows when no free block fits a request.
+ *
+ * The adaptive policy, the default, grows by doubling steps while
+ * requests keep running out of free blocks, so a heap that grows steadily
+ * makes few calls to sbrk. The steps stay small next to the heap, and
+ * start over once the heap is trimmed.
+ *
+ * @param[in] policy  The growth policy to use.
+ *
+ * @return  The previous policy.
+ */
+extern mm_growth_t mm_set_growth(mm_growth_t policy);
+
+/**
+ * @brief  Set the size from which free blocks are kept in address order.
+ *
+ * Free blocks of at least `threshold` bytes are kept in order of size and
+ * then address, so a request is placed in the lowest addressed of the
+ * smallest blocks that fit. Smaller ones are reused most recently freed
+ * first. Blocks larger than 256 bytes are always kept in address order.
+ * The threshold applies from the next call of mm_init.
+ *
+ * @param[in] threshold  The smallest free block to keep in address order,
+ *                       or SIZE_MAX for the default.
+ *
+ * @return  The previous threshold.
+ */
+extern size_t mm_set_ordered_threshold(size_t threshold);
+
+/**
+ * @brief  Give free memory at the top of the heap back to the system.
+ *
+ * @param[in] pad  The number of free bytes to keep at the top of the heap.
+ *
+ * @return  True if any memory was given back, False otherwise.
+ */
+extern bool mm_trim(size_t pad);
+
+/**
+ * @brief  Allocate `n` blocks of at least `size` bytes each.
+ *
+ * Neighbouring blocks are carved out of one free region where possible,
+ * which is cheaper than `n` separate calls to malloc.
+ *
+ * @param[in] size  The minimum size of bytes of each block.
+ * @param[out] ptrs  Array receiving the pointers to the blocks.
+ * @param[in] n  The number of blocks wanted.
+ *
+ * @return  The number of blocks allocated, stored at the start of `ptrs`;
+ *          less than `n` only if memory ran out or `size` is 0.
+ */
+extern size_t mm_malloc_batch(size_t size, void **ptrs, size_t n);
+
+/**
+ * @brief  Free an array of allocated payloads at once.
+ *
+ * The array is sorted by address in place, and blocks that lie next to
+ * each other are merged before they return to the free lists.
+ *
+ * @param[in,out] ptrs  The payloads to free; NULL entries are ignored.
+ * @param[in] n  The number of entries in `ptrs`.
+ */
+extern void mm_free_batch(void **ptrs, size_t n);
+
+/** @brief Counters kept for one segregated free list */
+typedef struct {
+    size_t free_blocks; /* free blocks currently held in the list */
+    size_t free_bytes;  /* total size of those blocks */
+    size_t fit_hits;    /* fit searches satisfied from the list */
+} mm_bin_stats_t;
+
+/**
+ * @brief  Report the counters of each segregated free list.
+ *
+ * @param[out] stats  Array receiving one entry per list.
+ * @param[in] n  The number of entries `stats` can hold.
+ *
+ * @return  The number of lists the allocator maintains.
+ */
+extern size_t mm_bin_stats(mm_bin_stats_t *stats, size_t n);
+
+/** @brief Number of buckets in the fit search length histogram */
+#define MM_SEARCH_BUCKETS 8
+
+/** @brief Counters describing what the allocator has done since mm_init */
+typedef struct {
+    size_t mallocs;      /* payloads handed out, by any allocation call */
+    size_t frees;        /* payloads freed, by free or mm_free_batch */
+    size_t reallocs;     /* calls to realloc */
+    size_t bytes_in_use; /* usable bytes of the live payloads */
+    size_t heap_size;    /* bytes obtained from mem_sbrk */
+    size_t splits;       /* free blocks split to fit a request */
+    size_t coalesces;    /* free blocks merged into a neighbour */
+    size_t extends;      /* times the heap was grown */
+    /* fit searches by the number of free blocks they looked at: none in
+       bucket 0, 2^(i-1) up to 2^i - 1 in bucket i, and the last bucket
+       also holds every longer search */
+    size_t searches[MM_SEARCH_BUCKETS];
+} mm_stats_t;
+
+/**
+ * @brief  Report the allocator's counters.
+ *
+ * The heap size is always reported. The other counters are only kept
+ * when mm.c is built with MM_STATS, and are zero otherwise, so a normal
+ * build pays nothing for them. The free blocks and bytes of each list
+ * are reported by mm_bin_stats.
+ *
+ * @param[out] stats  Receives the counters.
+ *
+ * @return  True if the counters are kept, False otherwise.
+ */
+extern bool mm_stats(mm_stats_t *stats);
+
 #endif /* mm.h */
@@ -0,0 +1,235 @@
+/*
+ * mtstress.c - Multithreaded stress test for the THREAD_SAFE build of mm.c
+ *
+ * Every round starts NUM_THREADS threads, more than there are arenas, so
+ * arenas are shared and every one of them is used. Each thread mallocs,
+ * callocs, reallocs and frees blocks at random, filling every block with
+ * its own byte and checking that byte before the block is freed or
+ * resized. A thread also trades blocks with the others through a shared
+ * table, so blocks are regularly freed or reallocated by a thread of
+ * another arena than the one that allocated them. Threads exit at the end
+ * of every round, flushing their caches, and the heap is checked before
+ * the next round starts new ones.
+ *
+ * Build it against mm.c with THREAD_SAFE, and with ASan or TSan:
+ *
+ *     unix> make stress
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memlib.h"
+#include "mm.h"
+
+#define NUM_THREADS 12  /* threads per round */
+#define NUM_ROUNDS 4    /* rounds of threads started and joined */
+#define NUM_OPS 40000   /* operations per thread and round */
+#define NUM_SLOTS 256   /* blocks a thread holds at most */
+#define NUM_SHARED 64   /* blocks waiting to change threads */
+#define MAX_SMALL 300   /* largest size of most requests */
+#define MAX_LARGE 20000 /* largest size of the occasional large request */
+#define MAX_HUGE 300000 /* largest size of the rare mapped request */
+
+/* A block, with the byte every one of its payload bytes holds */
+typedef struct {
+    unsigned char *p;
+    size_t size;
+    unsigned char fill;
+} slot_t;
+
+/* Blocks handed from one thread to another, under shared_lock */
+static slot_t shared[NUM_SHARED];
+static pthread_mutex_t shared_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * next_random - Advances a thread's xorshift state and returns it
+ */
+static uint32_t next_random(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+/*
+ * fail - Reports a broken block and stops the test
+ */
+static void fail(const char *what, const slot_t *slot) {
+    fprintf(stderr, "mtstress: %s (block %p, %zu bytes)\n", what,
+            (void *)slot->p, slot->size);
+    exit(1);
+}
+
+/*
+ * check_slot - Checks that a block still holds its fill byte
+ */
+static void check_slot(const slot_t *slot, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        if (slot->p[i] != slot->fill) {
+            fail("payload overwritten", slot);
+        }
+    }
+}
+
+/*
+ * fill_slot - Gives a block a new fill byte
+ */
+static void fill_slot(slot_t *slot, uint32_t *state) {
+    slot->fill = (unsigned char)next_random(state);
+    memset(slot->p, slot->fill, slot->size);
+}
+
+/*
+ * random_size - Picks a request size, mostly small, rarely one large
+ * enough for a mapping of its own
+ */
+static size_t random_size(uint32_t *state) {
+    if (next_random(state) % 512 == 0) {
+        return next_random(state) % MAX_HUGE + 1;
+    }
+    if (next_random(state) % 16 == 0) {
+        return next_random(state) % MAX_LARGE + 1;
+    }
+    return next_random(state) % MAX_SMALL + 1;
+}
+
+/*
+ * allocate_slot - Fills an empty slot with a new block
+ */
+static void allocate_slot(slot_t *slot, uint32_t *state) {
+    slot->size = random_size(state);
+    if (next_random(state) % 8 == 0) {
+        slot->p = mm_calloc(1, slot->size);
+        if (slot->p != NULL) {
+            slot->fill = 0;
+            check_slot(slot, slot->size);
+        }
+    } else {
+        slot->p = mm_malloc(slot->size);
+    }
+    if (slot->p == NULL) {
+        fail("out of memory", slot);
+    }
+    fill_slot(slot, state);
+}
+
+/*
+ * resize_slot - Reallocates a block, which must keep its old bytes
+ */
+static void resize_slot(slot_t *slot, uint32_t *state) {
+    size_t size = random_size(state);
+    size_t kept = size < slot->size ? size : slot->size;
+    check_slot(slot, slot->size);
+    slot->p = mm_realloc(slot->p, size);
+    if (slot->p == NULL) {
+        fail("out of memory", slot);
+    }
+    slot->size = size;
+    check_slot(slot, kept);
+    fill_slot(slot, state);
+}
+
+/*
+ * free_slot - Frees a block after checking it
+ */
+static void free_slot(slot_t *slot) {
+    check_slot(slot, slot->size);
+    mm_free(slot->p);
+    slot->p = NULL;
+}
+
+/*
+ * trade_slot - Swaps a slot with a random entry of the shared table, so
+ * that either may end up with another thread
+ */
+static void trade_slot(slot_t *slot, uint32_t *state) {
+    size_t i = next_random(state) % NUM_SHARED;
+    pthread_mutex_lock(&shared_lock);
+    slot_t other = shared[i];
+    shared[i] = *slot;
+    *slot = other;
+    pthread_mutex_unlock(&shared_lock);
+}
+
+/*
+ * worker - Runs NUM_OPS random operations, then frees what it holds
+ */
+static void *worker(void *arg) {
+    uint32_t state = (uint32_t)(uintptr_t)arg * 2654435761u + 1;
+    slot_t *slots = calloc(NUM_SLOTS, sizeof(*slots));
+    if (slots == NULL) {
+        fprintf(stderr, "mtstress: calloc failed\n");
+        exit(1);
+    }
+
+    for (size_t op = 0; op < NUM_OPS; op++) {
+        slot_t *slot = &slots[next_random(&state) % NUM_SLOTS];
+        uint32_t action = next_random(&state) % 8;
+        if (action == 0) {
+            trade_slot(slot, &state);
+        } else if (slot->p == NULL) {
+            allocate_slot(slot, &state);
+        } else if (action == 1) {
+            resize_slot(slot, &state);
+        } else {
+            free_slot(slot);
+        }
+    }
+
+    for (size_t i = 0; i < NUM_SLOTS; i++) {
+        if (slots[i].p != NULL) {
+            free_slot(&slots[i]);
+        }
+    }
+    free(slots);
+    return NULL;
+}
+
+int main(void) {
+    mem_init(false);
+    if (!mm_init()) {
+        fprintf(stderr, "mtstress: mm_init failed\n");
+        return 1;
+    }
+
+    pthread_t threads[NUM_THREADS];
+    for (size_t round = 0; round < NUM_ROUNDS; round++) {
+        for (size_t i = 0; i < NUM_THREADS; i++) {
+            void *seed = (void *)(uintptr_t)(round * NUM_THREADS + i + 1);
+            if (pthread_create(&threads[i], NULL, worker, seed) != 0) {
+                fprintf(stderr, "mtstress: pthread_create failed\n");
+                return 1;
+            }
+        }
+        for (size_t i = 0; i < NUM_THREADS; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        if (!mm_checkheap(__LINE__)) {
+            fprintf(stderr, "mtstress: heap check failed after round %zu\n",
+                    round);
+            return 1;
+        }
+    }
+
+    /* The blocks left in the table go back from the main thread */
+    for (size_t i = 0; i < NUM_SHARED; i++) {
+        if (shared[i].p != NULL) {
+            free_slot(&shared[i]);
+        }
+    }
+    if (!mm_checkheap(__LINE__)) {
+        fprintf(stderr, "mtstress: heap check failed at the end\n");
+        return 1;
+    }
+
+    printf("mtstress: %d threads x %d rounds ok, heap %zu bytes\n",
+           NUM_THREADS, NUM_ROUNDS, mem_heapsize());
+    return 0;
+}